@@ -10,118 +10,62 @@
  *
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <sys/uio.h>
 
-#include "mblib.h"
-
-/** Memblock base types */
-typedef unsigned char   mbbyte_t;
-typedef unsigned short  uint16;
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
 
-/** \brief Unit used for memory map allocation */
-typedef unsigned int    mbword_t;
+#include "mblib.h"
+#include "mblib_int.h"
 
 /** Local constants */
 #define     MB_DEBUG                    0           /* 0 for no debug output */
 
-#define     MB_MAPWORD_SIZE             sizeof(mbword_t)
-#define     MB_MAP_NIB_PERWORD          (sizeof(mbword_t) << 1)
-#define     MB_MAP_BITS_PERNIB          4
-
-#define     MB_SMALLBLOCKS              0
-#define     MB_BIGBLOCKS                1
-#define     MB_SPACES                   2
-
-#define     MB_MAP_ALLOC_MIN_WORDS      4
-#define     MB_MAP_ALLOC_MAX_WORDS      32
-
-#define     MB_SBMAP_BYTES_PERNIB       16
-#define     MB_SBMAP_BYTES_PERWORD      (MB_SBMAP_BYTES_PERNIB * MB_MAP_NIB_PERWORD)
-
-#define     MB_BBMAP_BYTES_PERNIB       (MB_SBMAP_BYTES_PERWORD << 1)
-#define     MB_BBMAP_BYTES_PERWORD      (MB_BBMAP_BYTES_PERNIB * MB_MAP_NIB_PERWORD)
-
-#define     MB_MAP_ALLOC_LFN_MAP        0xF0000000          /* left most nibble  */
-#define     MB_MAP_ALLOC_RTN_MAP        0x0000000F          /* right nost nibble */
-#define     MB_MAP_ALLOC_MARK           0xF0000000
-#define     MB_MAP_ALLOC_END            0x10000000
-#define     MB_MAP_ALLOC_END_VAL        0x1
 
 /** Memory Block libraary error strings */
 const char *mb_errorstr[] = {   "OK",
                                 "No available memory for last allocation",
                                 "Requested memory allocation to big for memory spaces",
                                 "Referenced memory not in mblib space",
-                                "Map space is corrupted"};
-
-/**
- * \brief
- * Memory block map and block space
- *
- * \details
- * Each Memory block space is mapped with a nibble map of words
- *
- * Each 4 bits in the small block map represents 4 words of small block memory (16 bytes)
- * Each word in the small block map tracks 32 words of small block memory (128 bytes)
- *
- * Each 4 bits in the large block map represents 64 words of big block memory (256 bytes)
- * Each word in the big block map tracks 256 words (2k)
- *
- * The small block area allocates sizes from 16 to 128 bytes, rounding up to the closest 16 bytes (4 words)
- *
- * The big block area allocates sizes from 256 bytes to 2k, rounding up to the closest 256 bytes (64 words)
- *
- * Free memory is marked with 0 (4 bits for 4 words)
- *   A single allocated block (4 words) is marked allocated with a 1
- *
- *   More than 4 allocated words are marked allocated beginning 
- *   with an F and ending with a 1, with F's marked between
- *
- * Memory allocation is only done within map words, and not across them. This can
- * lead to some framentation if odd numbers of the minimum block size for a space
- * are allocated. Any number of block sizes for a space may be allocated from any 
- * map word
- *
- *  bytes_pernib    - bytes reserved per map nibble (4 bits)
- *  bytes_perword   - bytes reserved per map word
- *  mapwords        - number of map words for this space
- *  mi              - current index into map
- *  bmap            - block map
- *  block           - memory for blocks
- */
-typedef struct {
-    const uint16     bytes_pernib;
-    const uint16     bytes_perword;
-    uint16           mapwords;
-    uint16           mi;
-    mbword_t        *bmap;
-    mbbyte_t        *block;
-} mbspace_t;
-
-/** \brief 
-  * Memory block libary control block type
-  * \details
-  * err     - Last recorded error
-  * space   - Array of memory spaces 
-  */
-typedef struct {
-    MBERR       err;
-    mbspace_t   space[MB_SPACES];
-} mbcb_t;
+                                "Map space is corrupted",
+                                "Allocation transaction already active or log full",
+                                "Feature not enabled in instance configuration",
+                                "System call failed, check errno",
+                                "Block reference count at its maximum"};
 
 /**
  * \brief
- * Memory block libary control block
+ * Memory block libary control block of the root instance
  *
  * \details
  * Initialize control block last error, and for each memory space
  * the map's reserved bytes per nibble and word for convenience
  */
 mbcb_t mbcb = { MBERR_OK, { {MB_SBMAP_BYTES_PERNIB, MB_SBMAP_BYTES_PERWORD},
-                            {MB_BBMAP_BYTES_PERNIB, MB_BBMAP_BYTES_PERWORD} } };
+                            {MB_BBMAP_BYTES_PERNIB, MB_BBMAP_BYTES_PERWORD} }, {0}, NULL, {NULL}, NULL };
+
+/** \brief
+ *  Current memory block library instance, the root instance or a child instance
+ *
+ *  \details
+ *  Seen through the leading control block members mballoc_fast() reads, which
+ *  must lie where they do in mbcb_t. mblib.c uses it as mbcur.
+ */
+mbfast_t *mb_cur = (mbfast_t *)&mbcb;
+
+_Static_assert(offsetof(mbcb_t, space) == offsetof(mbfast_t, space), "mbfast_t space");
+_Static_assert(offsetof(mbcb_t, tx.active) == offsetof(mbfast_t, txactive), "mbfast_t txactive");
 
 /** \brief
  *  Array used to hold block allocations per block size per space
@@ -149,7 +93,7 @@ int mbblkstat[MB_SPACES * MB_MAP_NIB_PERWORD];
 MBERR
 mberr(void)
 {
-    return mbcb.err;
+    return mbcur->err;
 }
 
 /**
@@ -215,10 +159,10 @@ mbstatcalc(mbspace_t *space, int *blkstat)
         wi = 0;
         /* scan through a map word for allocated blocks */
         while (wi < MB_MAP_NIB_PERWORD) {
-            if (space->bmap[mi] & amask) {
+            if (mbmapget(space, mi) & amask) {
                 /* found a block, now figure out its size */
                 blk = 0;
-                while (mbnibval(space->bmap[mi], wi) != MB_MAP_ALLOC_END_VAL) {
+                while (mbnibval(mbmapget(space, mi), wi) != MB_MAP_ALLOC_END_VAL) {
                     wi++;
                     blk++;
                     if (wi >= MB_MAP_NIB_PERWORD) {
@@ -259,8 +203,8 @@ mbstatget(int *blkstat[])
     memset(mbblkstat, 0, sizeof(mbblkstat));
 
     for (i=0; i < MB_SPACES; i++) {
-        if (mbstatcalc(&mbcb.space[i], &mbblkstat[i * MB_MAP_NIB_PERWORD])) {
-            mbcb.err = MBERR_MAPCORRUPT;
+        if (mbstatcalc(&mbcur->space[i], &mbblkstat[i * MB_MAP_NIB_PERWORD])) {
+            mbcur->err = MBERR_MAPCORRUPT;
             return 0;
         }
     }
@@ -272,228 +216,3346 @@ mbstatget(int *blkstat[])
 
 /**
  * \brief
- * Return an incremented map index
+ * Find the block space for an allocation size
  *
  * \details
- * Increment the given map index, and wrap if needed 
+ * Returns the first space whose map word can hold the given size, or NULL if
+ * the size is too big for all spaces
  */
-static inline uint16
-mbimapinc(uint16 mi, uint16 mapwords)
+static mbspace_t *
+mbspacefor(unsigned long size)
 {
-    return (++mi < mapwords ? mi : 0);
+    int i;
+
+    for (i=0; i < MB_SPACES; i++) {
+        if (size <= mbcur->space[i].bytes_perword) {
+            return &mbcur->space[i];
+        }
+    }
+    return NULL;
 }
 
 
 /**
  * \brief
- * Initialize memory block library
+ * Find the block space a memory block pointer is in
  *
  * \details
- * Mallocs map and block spaces contiguously
+ * Returns the space whose block area holds the given pointer, or NULL if it is
+ * not in any space. Space maps are not part of a block area.
+ */
+static mbspace_t *
+mbspaceof(void *mbp)
+{
+    int         i;
+    mbspace_t   *space;
+
+    space = &mbcur->space[MB_SMALLBLOCKS];
+    for (i=0; i < MB_SPACES; i++) {
+        if ((mbbyte_t *)mbp >= space->block &&
+            (mbbyte_t *)mbp < space->block + (space->mapwords * space->bytes_perword)) {
+            break;
+        }
+        space++;
+    }
+    if (i == MB_SPACES) {
+        return NULL;
+    }
+
+    /* blocks in borrowed big block map words are in the small block space over the map word */
+    if (i == MB_BIGBLOCKS && mbcur->borrowed) {
+        for (i=0; i < mbcur->nborrow; i++) {
+            if (mbcur->borrow[i].space.block != NULL &&
+                (mbbyte_t *)mbp >= mbcur->borrow[i].space.block &&
+                (mbbyte_t *)mbp < mbcur->borrow[i].space.block + space->bytes_perword) {
+                return &mbcur->borrow[i].space;
+            }
+        }
+    }
+    return space;
+}
+
+
+/**
+ * \brief
+ * Find the borrow slot of a space
  *
- * Allocates the number of k (1024) of smallest blocks for the small block space and
- *                         k (1024) of smallest blocks for the big block space.
+ * \details
+ * Returns the borrow slot whose small block space is the given space, or NULL
+ * if it is one of the spaces of the instance
+ */
+static mbborrow_t *
+mbborrowof(mbspace_t *space)
+{
+    if (mbcur->nborrow == 0 || space < &mbcur->borrow[0].space ||
+        space > &mbcur->borrow[mbcur->nborrow - 1].space) {
+        return NULL;
+    }
+    return (mbborrow_t *)space;
+}
+
+
+/**
+ * \brief
+ * Get the number of map nibbles of an allocated run
  *
- * \param[in] k_sb_smallest   k of smallest blocks for small block space
- * \param[in] k_bb_smallest   k of smallest blocks for big block space 
+ * \details
+ * Decodes the run starting at nibble wi of map word mi, up to its end nibble.
+ * Returns 0 if the run has no end nibble in the map word.
+ */
+static int
+mbrunnibs(mbspace_t *space, uint16 mi, uint16 wi)
+{
+    int nibs;
+
+    for (nibs = 1; mbnibval(mbmapget(space, mi), wi) != MB_MAP_ALLOC_END_VAL; nibs++) {
+        if (++wi >= MB_MAP_NIB_PERWORD) {
+            if (MB_DEBUG) {
+                assert(0);
+            }
+            return 0;
+        }
+    }
+    return nibs;
+}
+
+
+/**
+ * \brief
+ * Get the map location of a memory block pointer
  *
+ * \details
+ * Sets the map word index and nibble index in the map word of the given
+ * pointer in the given space
  */
-void
-mbinit(int k_sb_smallest, int k_bb_smallest)
+static void
+mbptrloc(mbspace_t *space, void *mbp, uint16 *mi, uint16 *wi)
 {
-    mbspace_t *space, *prevspace;
+    unsigned long off;
 
-    /* set up mapwords for spaces */
-    mbcb.space[MB_SMALLBLOCKS].mapwords = k_sb_smallest * 1024 / MB_MAP_NIB_PERWORD;
-    mbcb.space[MB_BIGBLOCKS].mapwords = k_bb_smallest * 1024 / MB_MAP_NIB_PERWORD;
+    off = (mbbyte_t *)mbp - space->block;
+    *mi = off / space->bytes_perword;
+    *wi = (off % space->bytes_perword) / space->bytes_pernib;
+}
 
-    /* Malloc all required memory for space maps and block areas contiguously */
-    mbcb.space[MB_SMALLBLOCKS].bmap = 
-            malloc((mbcb.space[MB_SMALLBLOCKS].mapwords * (MB_MAPWORD_SIZE + MB_SBMAP_BYTES_PERWORD) +
-                   (mbcb.space[MB_BIGBLOCKS].mapwords *   (MB_MAPWORD_SIZE + MB_BBMAP_BYTES_PERWORD)) ));
 
-    /* Clear out all the map and block areas */
-    memset(mbcb.space[MB_SMALLBLOCKS].bmap, 0,
-           (mbcb.space[MB_SMALLBLOCKS].mapwords * (MB_MAPWORD_SIZE + MB_SBMAP_BYTES_PERWORD) +
-           (mbcb.space[MB_BIGBLOCKS].mapwords   * (MB_MAPWORD_SIZE + MB_BBMAP_BYTES_PERWORD)) ));
+/**
+ * \brief
+ * Find the tightest free run in a map word
+ *
+ * \details
+ * Returns the nibble index of the shortest free run of at least n nibbles in the
+ * map word, or -1 if no free run is long enough.
+ */
+static int
+mbwordbest(mbword_t mword, int n)
+{
+    int i, start, run, bwi, brun;
+
+    bwi = -1;
+    brun = MB_MAP_NIB_PERWORD + 1;
+    for (i=0, start=0, run=0; i <= MB_MAP_NIB_PERWORD; i++) {
+        if (i < MB_MAP_NIB_PERWORD && !(mword & (MB_MAP_ALLOC_LFN_MAP >> (i * MB_MAP_BITS_PERNIB)))) {
+            if (run++ == 0) {
+                start = i;
+            }
+            continue;
+        }
+        if (run >= n && run < brun) {
+            brun = run;
+            bwi = start;
+        }
+        run = 0;
+    }
+    return bwi;
+}
 
-    /* Set up space for small blocks */
-    space = &mbcb.space[MB_SMALLBLOCKS];
-    space->block = (mbbyte_t *)(space->bmap + space->mapwords);
-    space->mi = 0;
 
-    /* Set up space for big blocks */
-    prevspace = space;
-    space++;
-    space->bmap = (mbword_t *)(prevspace->block + (prevspace->mapwords * prevspace->bytes_perword));
-    space->block = (mbbyte_t *)(space->bmap + space->mapwords);
-    space->mi = 0;
+/**
+ * \brief
+ * Unlink a map word from its slab list
+ */
+static void
+mbslabunlink(mbspace_t *space, uint16 mi, int list)
+{
+    uint16 next, prev;
 
-    /* clear out allocation stats */
-    memset(mbblkstat, 0, sizeof(mbblkstat));
+    next = space->slabnext[mi];
+    prev = space->slabprev[mi];
+    if (prev == MB_SLAB_NIL) {
+        space->slabhead[list] = next;
+    } else {
+        space->slabnext[prev] = next;
+    }
+    if (next != MB_SLAB_NIL) {
+        space->slabprev[next] = prev;
+    }
 }
 
+
 /**
  * \brief
- * Terminate memory block management
+ * Push a map word on a slab list
+ */
+static void
+mbslabpush(mbspace_t *space, uint16 mi, int list)
+{
+    space->slabprev[mi] = MB_SLAB_NIL;
+    space->slabnext[mi] = space->slabhead[list];
+    if (space->slabhead[list] != MB_SLAB_NIL) {
+        space->slabprev[space->slabhead[list]] = mi;
+    }
+    space->slabhead[list] = mi;
+}
+
+
+/**
+ * \brief
+ * Update the slab lists for a changed map word
  *
  * \details
- * Releases memory used for block management back to the OS
+ * An empty map word goes on the empty list. A map word of a run length is on
+ * the partial list of the length while another run of that length fits in it.
+ * A map word taken off the empty list other than by a slab allocation holds
+ * runs of any length until it empties.
  */
-void
-mbterm()
+static void
+mbslabset(mbspace_t *space, uint16 mi, mbword_t mword)
 {
-    free(mbcb.space[MB_SMALLBLOCKS].bmap);
+    int         cls;
+    mbbyte_t    tag;
+
+    tag = space->slabcls[mi];
+    cls = tag & ~(MB_SLAB_MIXED | MB_SLAB_PARTIAL);
+    if (mword == 0) {
+        if (tag & MB_SLAB_PARTIAL) {
+            mbslabunlink(space, mi, cls);
+        }
+        if (tag != MB_SLAB_EMPTY) {
+            space->slabcls[mi] = MB_SLAB_EMPTY;
+            mbslabpush(space, mi, 0);
+        }
+    } else if (tag == MB_SLAB_EMPTY) {
+        mbslabunlink(space, mi, 0);
+        space->slabcls[mi] = MB_SLAB_MIXED;
+    } else if (cls) {
+        if (mbspacefit(space, mword, MB_MAP_RUNMASK(cls)) >= 0) {
+            if (!(tag & MB_SLAB_PARTIAL)) {
+                space->slabcls[mi] = tag | MB_SLAB_PARTIAL;
+                mbslabpush(space, mi, cls);
+            }
+        } else if (tag & MB_SLAB_PARTIAL) {
+            space->slabcls[mi] = cls;
+            mbslabunlink(space, mi, cls);
+        }
+    }
 }
 
 
 /**
  * \brief
- * Allocate memory block space
+ * Reset the slab lists of a space
  *
  * \details
- * Rounds the given size up to the closest block size in the
- * appropriate block space, and marks that space used on the
- * corresponding space map.
- *
- * \param[in] size    number of bytes requested
- *
- * \returns   pointer to bytes allocate or NULL if not available
- *            If NULL returned check mberr code for reason
+ * With all map words empty only the high water map word is reset. Otherwise
+ * every map word is put on the empty list or marked as holding runs of any length.
  */
-void *
-mballoc(unsigned long size)
+static void
+mbslabbuild(mbspace_t *space, int empty)
 {
-    int         i, nwords, wi;
-    uint16      mi;
-    mbword_t    smask, amask;   /* start mask, current alloc mask */
-    mbspace_t   *space;
-    void        *ret;
+    uint16 mi;
 
-    space = NULL;
-    for (i=0; i < MB_SPACES; i++) {
-        if (size <= mbcb.space[i].bytes_perword) {
-            /* found block space to use */
-            space = &mbcb.space[i];
-            break;
+    memset(space->slabhead, 0xFF, sizeof(space->slabhead));
+    space->hwm = 0;
+    if (empty) {
+        return;
+    }
+    for (mi = space->mapwords; mi > 0; mi--) {
+        space->slabcls[mi - 1] = MB_SLAB_MIXED;
+        if (mbmapget(space, mi - 1) == 0) {
+            space->slabcls[mi - 1] = MB_SLAB_EMPTY;
+            mbslabpush(space, mi - 1, 0);
         }
     }
+    space->hwm = space->mapwords;
+}
 
-    /* if no pace found return NULL */
-    if (space == NULL) {
-        MB_DEBUG_PRINT("Cannot allocate %d bytes, only up to %d bytes at a time\n",
-                       size, (int)(MB_BBMAP_BYTES_PERWORD));
-        mbcb.err = MBERR_BIG;
-        return NULL;
+
+/**
+ * \brief
+ * Move a changed map word to the bucket of its free nibble count
+ *
+ * \details
+ * Full map words are on no bucket.
+ */
+static void
+mbfullset(mbspace_t *space, uint16 mi, mbword_t mword)
+{
+    int k;
+
+    k = mbwordfree(mword);
+    if (space->slabcls[mi] == k) {
+        return;
     }
+    if (space->slabcls[mi]) {
+        mbslabunlink(space, mi, space->slabcls[mi]);
+    }
+    if (k) {
+        mbslabpush(space, mi, k);
+    }
+    space->slabcls[mi] = k;
+}
 
-    nwords = (size + space->bytes_pernib - 1) / space->bytes_pernib;
 
-    /* generate allocation mask to use */
-    smask = MB_MAP_ALLOC_END;
-    for (i=1; i < nwords; i++) {
-        smask >>= MB_MAP_BITS_PERNIB;
-        smask |= MB_MAP_ALLOC_MARK;
+/**
+ * \brief
+ * Put every map word of a space in the bucket of its free nibble count
+ */
+static void
+mbfullbuild(mbspace_t *space)
+{
+    uint16 mi;
+
+    memset(space->slabhead, 0xFF, sizeof(space->slabhead));
+    memset(space->slabcls, 0, space->mapwords);
+    for (mi = space->mapwords; mi > 0; mi--) {
+        mbfullset(space, mi - 1, mbmapget(space, mi - 1));
     }
+    space->hwm = space->mapwords;
+}
 
-    /* Scan left to right through word map with alloc mask for space */
-    mi = space->mi;
-    wi = 0;
-    amask = smask;
-    while (space->bmap[mi]) {
-        if (amask & space->bmap[mi]) {
-            if (amask & MB_MAP_ALLOC_RTN_MAP) {
-                mi = mbimapinc(mi, space->mapwords);
-                wi = 0;
-                amask = smask;
-                /* if back to where the serch started then no space */
-                if (mi == space->mi) {
-                    MB_DEBUG_PRINT("No space found for %d bytes!\n", size);
-                    mbcb.err = MBERR_NOMEM;
-                    return NULL;
-                }
-            } else {
-                amask >>= MB_MAP_ALLOC_MIN_WORDS;
-                wi++;
+
+/**
+ * \brief
+ * Set a map word
+ *
+ * \details
+ * Stores the map word and moves it to the bitmap of its new longest free run
+ * in the run index, or to its slab list or fullness bucket, when the space keeps them
+ */
+static void
+mbmapset(mbspace_t *space, uint16 mi, mbword_t mword)
+{
+    int         from, to;
+    uint16      nidx;
+
+    if (space->policy == MB_POLICY_FIRSTFIT || space->policy == MB_POLICY_BESTFIT) {
+        from = mbspacerun(space, space->bmap[mi]);
+        to = mbspacerun(space, mword);
+        if (from != to) {
+            nidx = space->mapwords >> 5;
+            if (from) {
+                space->runidx[(from - 1) * nidx + (mi >> 5)] &= ~(1U << (mi & 31));
+            }
+            if (to) {
+                space->runidx[(to - 1) * nidx + (mi >> 5)] |= 1U << (mi & 31);
             }
-        } else {
-            /* found free block */
-            break;
         }
     }
-
-    /* Mark space allocated on map and increment map index if at end of word */
-    space->bmap[mi] |= amask;
-    space->mi = mi;
-    if (space->bmap[mi] & MB_MAP_ALLOC_RTN_MAP) {
-        space->mi = mbimapinc(mi, space->mapwords);
+    space->freenibs += mbwordfree(mword);
+    space->freenibs -= mbwordfree(space->bmap[mi]);
+    space->bmap[mi] = mword;
+
+    /* map words above the high water map word are on no slab list */
+    if (space->policy == MB_POLICY_SLAB && mi < space->hwm) {
+        mbslabset(space, mi, mword);
+    } else if (space->policy == MB_POLICY_FULLEST && mi < space->hwm) {
+        mbfullset(space, mi, mword);
     }
-
-    mbcb.err = MBERR_OK;
-    ret =  &space->block[(mi * space->bytes_perword) + (wi * space->bytes_pernib)];
-    MB_DEBUG_PRINT("Allocating %d words for %d bytes at %p:mi %d wi %d amask %.8X\n", 
-                   nwords, size, ret, mi, wi, amask);
-    return ret;
 }
 
 
 /**
  * \brief
- * Free memory allocated by mballoc
+ * Rebuild the run index of a space
  *
  * \details
- * Frees all the memory that was allocated starting from this address.
- * Do not pass in an address that was not returned from mballoc().
- * If the address given is not in the memory spaces then mberr will be set.
- *
- * \param[in]   mbp     memory block pointer
- *
- * \note
- * If there is a problem freeing the mblib mberr will be set
+ * Sets the bitmap bit of each map word for its longest free run
  */
-void
-mbfree(void *mbp)
+static void
+mbidxbuild(mbspace_t *space)
 {
-    int         i,found;
-    uint16      mi, wi;
-    mbword_t    fmask;
-    mbspace_t   *space;
+    int         run;
+    uint16      mi, nidx;
+
+    nidx = space->mapwords >> 5;
+    memset(space->runidx, 0, MB_MAP_NIB_PERWORD * nidx * MB_MAPWORD_SIZE);
+    for (mi = 0; mi < space->mapwords; mi++) {
+        if ((run = mbspacerun(space, mbmapget(space, mi))) != 0) {
+            space->runidx[(run - 1) * nidx + (mi >> 5)] |= 1U << (mi & 31);
+        }
+    }
+}
 
-    MB_DEBUG_PRINT("Trying to free memory at %p\n", mbp);
 
-    /* Find which space the memory being freed is in */
-    space = &mbcb.space[MB_SMALLBLOCKS];
-    found = 0;
-    for (i=0; i < MB_SPACES; i++) {
-        if (mbp < (void *) (space->block + (space->mapwords * space->bytes_perword))) {
-            found = 1;
-            break;
+/**
+ * \brief
+ * Find a map word in the run index
+ *
+ * \details
+ * Returns the lowest map word whose longest free run is from 'from' to 'to'
+ * nibbles, or -1 if there is none
+ */
+static long
+mbidxfind(mbspace_t *space, int from, int to)
+{
+    int         run;
+    uint16      k, nidx;
+    mbword_t    bits;
+
+    nidx = space->mapwords >> 5;
+    for (k = 0; k < nidx; k++) {
+        for (run = from, bits = 0; run <= to; run++) {
+            bits |= space->runidx[(run - 1) * nidx + k];
+        }
+        if (bits) {
+            return (k << 5) + __builtin_ctz(bits);
         }
-        space++;
     }
+    return -1;
+}
 
-    if (!found) {
-        MB_DEBUG_PRINT("Tried to free memory not owned by mblib at %p\n", mbp);
-        mbcb.err = MBERR_UNKNOWN;
-        return;
+
+/**
+ * \brief
+ * Claim a free run
+ *
+ * \details
+ * Marks the run of the given start mask allocated at nibble wi of map word mi,
+ * and logs it if an allocation transaction is active
+ */
+static void
+mbrunclaim(mbspace_t *space, uint16 mi, int wi, mbword_t smask)
+{
+    mbtxent_t *txent;
+
+    mbmapset(space, mi, space->bmap[mi] | (smask >> (wi * MB_MAP_BITS_PERNIB)));
+
+    /* log the claimed run so an aborted transaction can free it */
+    if (mbcur->tx.active) {
+        txent = &mbcur->tx.log[mbcur->tx.n++];
+        txent->space = space;
+        txent->mi = mi;
+        txent->nibs = MB_MAP_NIBMASK(mbrunnibs(space, mi, wi)) >> (wi * MB_MAP_BITS_PERNIB);
     }
+}
 
-    mi = (mbp - (void *)space->block) / space->bytes_perword;
-    wi = ((mbp - (void *)space->block) % space->bytes_perword) / space->bytes_pernib;
-    fmask = MB_MAP_ALLOC_LFN_MAP >> (wi * MB_MAP_ALLOC_MIN_WORDS);
-    while (mbnibval(space->bmap[mi], wi++) != MB_MAP_ALLOC_END_VAL) {
-        if (wi >= MB_MAP_NIB_PERWORD) {
-            mbcb.err = MBERR_MAPCORRUPT;
-            if (MB_DEBUG) {
-                assert(0);
-            }
-            return;
-        }
-        fmask |= fmask >> MB_MAP_BITS_PERNIB;
+
+/**
+ * \brief
+ * Claim a free run in a given map word
+ *
+ * \details
+ * Claims the run of the given start mask in map word mi of the space.
+ * Returns the nibble index of the claimed run, or -1 if the run does not fit
+ * or mi is outside the map.
+ */
+static int
+mbwordclaim(mbspace_t *space, long mi, mbword_t smask)
+{
+    int wi;
+
+    if (mi < 0 || mi >= space->mapwords ||
+        (wi = mbspacefit(space, mbmapget(space, mi), smask)) < 0) {
+        return -1;
     }
-    MB_DEBUG_PRINT("Freed memory at space %i mi %d wi %d fmask %.8X\n", i, mi, wi, fmask);
+    mbrunclaim(space, mi, wi, smask);
+    return wi;
+}
 
-    space->bmap[mi] &= ~fmask;
+
+/**
+ * \brief
+ * Free an allocated run
+ *
+ * \details
+ * Clears the run starting at nibble wi of map word mi from the map.
+ * Returns the number of nibbles freed, or 0 if the run has no end nibble
+ * in the map word.
+ */
+static int
+mbrunfree(mbspace_t *space, uint16 mi, uint16 wi)
+{
+    int nibs;
+
+    nibs = mbrunnibs(space, mi, wi);
+    if (nibs) {
+        mbmapset(space, mi, space->bmap[mi] & ~(MB_MAP_NIBMASK(nibs) >> (wi * MB_MAP_BITS_PERNIB)));
+
+        /* move the lifetime indexes back so each end of the space stays packed */
+        if (mi < space->lmi) {
+            space->lmi = mi;
+        }
+        if (mi > space->smi) {
+            space->smi = mi;
+        }
+
+        /* longer runs fit in the current map word again */
+        if (mi == space->mi) {
+            space->mifit = mbspacerun(space, space->bmap[mi]);
+        }
+    }
+    return nibs;
+}
+
+
+/**
+ * \brief
+ * Give back a borrowed big block map word once it is empty
+ *
+ * \details
+ * Does nothing if the space is not a borrowed map word or still has blocks.
+ * Called wherever runs are cleared from a space.
+ */
+static void
+mbborrowret(mbspace_t *space)
+{
+    uint16      mi;
+    mbborrow_t  *slot;
+
+    if ((slot = mbborrowof(space)) == NULL || space->block == NULL) {
+        return;
+    }
+    for (mi=0; mi < space->mapwords && space->bmap[mi] == 0; mi++)
+        ;
+    if (mi == space->mapwords) {
+        mbrunfree(&mbcur->space[MB_BIGBLOCKS], slot->bmi, 0);
+        space->block = NULL;
+        mbcur->borrowed--;
+        MB_DEBUG_PRINT("Returned big block map word %d\n", slot->bmi);
+    }
+}
+
+
+/**
+ * \brief
+ * Get the side array memory needed per map word
+ *
+ * \details
+ * Returns the bytes of side arrays kept for each map word of an instance with
+ * the given configuration
+ */
+static size_t
+mbmetasize(const mbconfig_t *config)
+{
+    size_t size;
+
+    size = sizeof(uint16);                                  /* map generation */
+    size += MB_MAP_NIB_PERWORD / 8;                         /* run index bits */
+    if (config->sb_policy >= MB_POLICY_SLAB || config->bb_policy >= MB_POLICY_SLAB) {
+        size += 2 * sizeof(uint16) + sizeof(mbbyte_t);      /* slab lists and run lengths */
+    }
+    if (config->refs) {
+        size += MB_MAP_NIB_PERWORD * sizeof(uint16);        /* reference counts */
+    }
+    return size;
+}
+
+
+/**
+ * \brief
+ * Get the memory needed for an instance
+ *
+ * \details
+ * Returns the bytes needed for the space maps, block areas, borrow slots and
+ * side arrays of an instance with the given configuration
+ */
+static size_t
+mbmemsize(const mbconfig_t *config)
+{
+    return ((config->k_sb_smallest * 1024 / MB_MAP_NIB_PERWORD) *
+                (MB_MAPWORD_SIZE + MB_SBMAP_BYTES_PERWORD + mbmetasize(config)) +
+            (config->k_bb_smallest * 1024 / MB_MAP_NIB_PERWORD) *
+                (MB_MAPWORD_SIZE + MB_BBMAP_BYTES_PERWORD + mbmetasize(config)) +
+            config->borrow * sizeof(mbborrow_t));
+}
+
+
+/**
+ * \brief
+ * Check an instance configuration
+ *
+ * \details
+ * Returns 1 if the space sizes, placement policies, rounding modes, reserves
+ * and borrow slots of the configuration are in range, as the uint16 map word
+ * indexes, mbpolicy_set(), mbround_set() and mbreserve_set() require, or 0
+ * otherwise
+ */
+static int
+mbconfigok(const mbconfig_t *config)
+{
+    return config->k_sb_smallest >= 1 && config->k_sb_smallest <= MB_K_MAX &&
+           config->k_bb_smallest >= 1 && config->k_bb_smallest <= MB_K_MAX &&
+           config->sb_policy >= MB_POLICY_NEXTFIT && config->sb_policy <= MB_POLICY_FULLEST &&
+           config->bb_policy >= MB_POLICY_NEXTFIT && config->bb_policy <= MB_POLICY_FULLEST &&
+           config->sb_round >= MB_ROUND_NONE && config->sb_round <= MB_ROUND_POW2 &&
+           config->bb_round >= MB_ROUND_NONE && config->bb_round <= MB_ROUND_POW2 &&
+           config->sb_reserve >= 0 && config->sb_reserve <= config->k_sb_smallest * 1024 &&
+           config->bb_reserve >= 0 && config->bb_reserve <= config->k_bb_smallest * 1024 &&
+           config->borrow >= 0;
+}
+
+
+/**
+ * \brief
+ * Set up the spaces of an instance
+ *
+ * \details
+ * Lays out the space maps, block areas, borrow slots and side arrays
+ * contiguously in the given memory, which must hold mbmemsize() bytes, and
+ * clears them out
+ */
+static void
+mbsetup(mbcb_t *cb, void *mem, const mbconfig_t *config)
+{
+    int         i;
+    mbbyte_t    *meta;
+    mbspace_t   *space, *prevspace;
+
+    /* set up mapwords for spaces */
+    cb->space[MB_SMALLBLOCKS].mapwords = config->k_sb_smallest * 1024 / MB_MAP_NIB_PERWORD;
+    cb->space[MB_BIGBLOCKS].mapwords = config->k_bb_smallest * 1024 / MB_MAP_NIB_PERWORD;
+
+    /* Clear out all the map and block areas */
+    memset(mem, 0, mbmemsize(config));
+
+    /* Set up space for small blocks */
+    space = &cb->space[MB_SMALLBLOCKS];
+    space->bmap = mem;
+    space->block = (mbbyte_t *)(space->bmap + space->mapwords);
+    space->mi = 0;
+    space->mifit = MB_MAP_NIB_PERWORD;
+
+    /* Set up space for big blocks */
+    prevspace = space;
+    space++;
+    space->bmap = (mbword_t *)(prevspace->block + (prevspace->mapwords * prevspace->bytes_perword));
+    space->block = (mbbyte_t *)(space->bmap + space->mapwords);
+    space->mi = 0;
+    space->mifit = MB_MAP_NIB_PERWORD;
+
+    /* Set up borrow slots after the big block area */
+    cb->borrow = (mbborrow_t *)(space->block + (space->mapwords * space->bytes_perword));
+    cb->nborrow = config->borrow;
+    cb->borrowed = 0;
+
+    /* Set up side arrays after the borrow slots */
+    meta = (mbbyte_t *)(cb->borrow + cb->nborrow);
+    for (i=0, space = cb->space; i < MB_SPACES; i++, space++) {
+        space->lmi = 0;
+        space->smi = space->mapwords - 1;
+        space->gen = (uint16 *)meta;
+        space->curgen = 0;
+        meta += space->mapwords * sizeof(uint16);
+
+        space->refcnt = NULL;
+        if (config->refs) {
+            space->refcnt = (uint16 *)meta;
+            meta += space->mapwords * MB_MAP_NIB_PERWORD * sizeof(uint16);
+        }
+
+        space->runidx = (mbword_t *)meta;
+        meta += space->mapwords * MB_MAP_NIB_PERWORD / 8;
+
+        space->slabcls = NULL;
+        if (config->sb_policy >= MB_POLICY_SLAB || config->bb_policy >= MB_POLICY_SLAB) {
+            space->slabnext = (uint16 *)meta;
+            meta += space->mapwords * sizeof(uint16);
+            space->slabprev = (uint16 *)meta;
+            meta += space->mapwords * sizeof(uint16);
+            space->slabcls = meta;
+            meta += space->mapwords;
+            mbslabbuild(space, 1);
+        }
+
+        space->freenibs = space->mapwords * MB_MAP_NIB_PERWORD;
+        space->reserve = (i == MB_SMALLBLOCKS) ? config->sb_reserve : config->bb_reserve;
+        space->respeak = 0;
+        space->resprio = 0;
+        space->resdenied = 0;
+        space->scanned = 0;
+
+        space->align = config->align;
+        space->round = (i == MB_SMALLBLOCKS) ? config->sb_round : config->bb_round;
+        space->policy = (i == MB_SMALLBLOCKS) ? config->sb_policy : config->bb_policy;
+        if (space->policy == MB_POLICY_FIRSTFIT || space->policy == MB_POLICY_BESTFIT) {
+            mbidxbuild(space);
+        }
+    }
+}
+
+
+/**
+ * \brief
+ * Initialize memory block library
+ *
+ * \details
+ * Mallocs map and block spaces contiguously
+ *
+ * Allocates the number of k (1024) of smallest blocks for the small block space and
+ *                         k (1024) of smallest blocks for the big block space.
+ *
+ * \param[in] k_sb_smallest   k of smallest blocks for small block space
+ * \param[in] k_bb_smallest   k of smallest blocks for big block space 
+ *
+ */
+void
+mbinit(int k_sb_smallest, int k_bb_smallest)
+{
+    mbconfig_t config = { k_sb_smallest, k_bb_smallest, 0 };
+
+    mbinit_ex(&config);
+}
+
+
+/**
+ * \brief
+ * Initialize memory block library with a configuration
+ *
+ * \details
+ * Same as mbinit() with the space sizes given in the configuration.
+ * The library instance initialized is the root instance, which becomes the
+ * current instance. Nothing is initialized if the configuration is not valid.
+ *
+ * \param[in] config    instance configuration
+ */
+void
+mbinit_ex(const mbconfig_t *config)
+{
+    mb_cur = (mbfast_t *)&mbcb;
+    if (!mbconfigok(config)) {
+        MB_DEBUG_PRINT("Instance configuration is not valid\n");
+        mbcur->err = MBERR_CONFIG;
+        return;
+    }
+
+    /* Malloc all required memory for space maps, block areas and map generations contiguously */
+    mbsetup(&mbcb, malloc(mbmemsize(config)), config);
+
+    /* clear out allocation stats */
+    memset(mbblkstat, 0, sizeof(mbblkstat));
+    mbcur->err = MBERR_OK;
+}
+
+/**
+ * \brief
+ * Free the handle tables of the child instances of an instance
+ *
+ * \details
+ * Children and their own children live in the memory of the instance, so only
+ * their handle tables are freed. The instance is left with no children.
+ */
+static void
+mbfreechildren(mbcb_t *cb)
+{
+    mbcb_t *child;
+
+    for (child = cb->child; child != NULL; child = child->next) {
+        mbfreechildren(child);
+        free(child->htab.ent);
+    }
+    cb->child = NULL;
+}
+
+
+/**
+ * \brief
+ * Terminate memory block management
+ *
+ * \details
+ * Releases memory used for block management back to the OS
+ */
+void
+mbterm()
+{
+    mbfreechildren(&mbcb);
+    free(mbcb.space[MB_SMALLBLOCKS].bmap);
+    free(mbcb.htab.ent);
+    memset(&mbcb.htab, 0, sizeof(mbcb.htab));
+    mb_cur = (mbfast_t *)&mbcb;
+}
+
+
+/**
+ * \brief
+ * Create a child instance inside a parent instance
+ *
+ * \details
+ * Claims enough consecutive empty big block map words of the parent to hold the
+ * control block, space maps and block areas of a complete child instance with
+ * the given configuration. The child is used by making it the current instance
+ * with mbuse(). It is freed back to its parent with mbdestroy(), or when the
+ * parent is reset or terminated.
+ *
+ * \param[in] parent    parent instance, or NULL for the current instance
+ * \param[in] config    child instance configuration
+ *
+ * \return    child instance or NULL if there is no room in the parent
+ *            If NULL returned check mberr code for reason
+ */
+mbctx_t *
+mbcreate_in(mbctx_t *parent, const mbconfig_t *config)
+{
+    int         i, nwords, run;
+    uint16      mi;
+    size_t      cbsize;
+    mbspace_t   *space;
+    mbcb_t      *child, *prev;
+
+    if (parent == NULL) {
+        parent = mbcur;
+    }
+    if (parent->tx.active) {
+        mbcur->err = MBERR_TX;
+        return NULL;
+    }
+    if (!mbconfigok(config)) {
+        mbcur->err = MBERR_CONFIG;
+        return NULL;
+    }
+
+    cbsize = (sizeof(mbcb_t) + MB_SBMAP_BYTES_PERNIB - 1) & ~(size_t)(MB_SBMAP_BYTES_PERNIB - 1);
+    space = &parent->space[MB_BIGBLOCKS];
+    nwords = (cbsize + mbmemsize(config) + space->bytes_perword - 1) / space->bytes_perword;
+
+    /* find enough consecutive empty map words for the child, leaving the reserve */
+    if (space->freenibs < space->reserve + nwords * MB_MAP_NIB_PERWORD) {
+        MB_DEBUG_PRINT("No room for a child instance of %d map words\n", nwords);
+        mbcur->err = MBERR_NOMEM;
+        return NULL;
+    }
+    run = 0;
+    for (mi=0; mi < space->mapwords && run < nwords; mi++) {
+        run = mbmapget(space, mi) ? 0 : run + 1;
+    }
+    if (run < nwords) {
+        MB_DEBUG_PRINT("No room for a child instance of %d map words\n", nwords);
+        mbcur->err = MBERR_NOMEM;
+        return NULL;
+    }
+    mi -= nwords;
+
+    prev = mbuse(parent);
+    for (i=0; i < nwords; i++) {
+        mbrunclaim(space, mi + i, 0, MB_MAP_RUNMASK(MB_MAP_NIB_PERWORD));
+    }
+    mbuse(prev);
+
+    /* the child control block is at the start of its memory */
+    child = (mbcb_t *)&space->block[mi * space->bytes_perword];
+    memcpy(child, parent, sizeof(mbcb_t));
+    memset(&child->htab, 0, sizeof(child->htab));
+    child->tx.active = 0;
+    child->err = MBERR_OK;
+    child->parent = parent;
+    child->pmi = mi;
+    child->pwords = nwords;
+    child->child = NULL;
+    child->next = parent->child;
+    parent->child = child;
+    mbsetup(child, (mbbyte_t *)child + cbsize, config);
+
+    mbcur->err = MBERR_OK;
+    return child;
+}
+
+
+/**
+ * \brief
+ * Destroy a child instance
+ *
+ * \details
+ * Frees all the memory of a child instance back to its parent at once. If the
+ * child or one of its children is the current instance, its parent becomes the
+ * current instance. Children of the child are destroyed with it.
+ *
+ * \param[in] ctx       child instance returned by mbcreate_in()
+ */
+void
+mbdestroy(mbctx_t *ctx)
+{
+    int         i;
+    mbcb_t      *prev, *cb, **link;
+    mbspace_t   *space;
+
+    if (ctx == NULL || ctx->parent == NULL) {
+        mbcur->err = MBERR_UNKNOWN;
+        return;
+    }
+
+    /* the current instance goes with the child if it is the child or below it */
+    prev = mbcur;
+    for (cb = mbcur; cb != NULL; cb = cb->parent) {
+        if (cb == ctx) {
+            prev = ctx->parent;
+            break;
+        }
+    }
+    mbfreechildren(ctx);
+    free(ctx->htab.ent);
+
+    for (link = &ctx->parent->child; *link != NULL && *link != ctx; link = &(*link)->next)
+        ;
+    if (*link != NULL) {
+        *link = ctx->next;
+    }
+
+    mbuse(ctx->parent);
+    space = &mbcur->space[MB_BIGBLOCKS];
+    for (i=0; i < ctx->pwords; i++) {
+        mbrunfree(space, ctx->pmi + i, 0);
+    }
+    mbuse(prev);
+    mbcur->err = MBERR_OK;
+}
+
+
+/**
+ * \brief
+ * Set the current instance
+ *
+ * \details
+ * All memory block library calls work on the current instance.
+ *
+ * \param[in] ctx       instance to use, or NULL for the root instance
+ *
+ * \return    previous current instance
+ */
+mbctx_t *
+mbuse(mbctx_t *ctx)
+{
+    mbcb_t *prev;
+
+    prev = mbcur;
+    mb_cur = (mbfast_t *)(ctx ? ctx : &mbcb);
+    return prev;
+}
+
+/**
+ * \brief
+ * Allocate a run with the run index
+ *
+ * \details
+ * Picks the map word for a run of n nibbles with the first fit or best fit
+ * policy of the space, and claims the run
+ */
+static void *
+mballoc_idx(mbspace_t *space, int n, mbword_t smask)
+{
+    int     wi, run;
+    long    mi;
+
+    if (space->policy == MB_POLICY_FIRSTFIT) {
+        mi = mbidxfind(space, n, MB_MAP_NIB_PERWORD);
+    } else {
+        for (run = n, mi = -1; run <= MB_MAP_NIB_PERWORD && mi < 0; run++) {
+            mi = mbidxfind(space, run, run);
+        }
+    }
+    if (mi < 0) {
+        MB_DEBUG_PRINT("No space found for %d nibbles!\n", n);
+        mbcur->err = MBERR_NOMEM;
+        return NULL;
+    }
+
+    wi = (space->policy == MB_POLICY_FIRSTFIT || space->align) ?
+                mbspacefit(space, mbmapget(space, mi), smask) : mbwordbest(mbmapget(space, mi), n);
+    mbrunclaim(space, mi, wi, smask);
+
+    mbcur->err = MBERR_OK;
+    return &space->block[(mi * space->bytes_perword) + (wi * space->bytes_pernib)];
+}
+
+
+/**
+ * \brief
+ * Allocate a run from the slab lists
+ *
+ * \details
+ * Takes the first partly used map word of the run length, or else an empty map
+ * word from the empty list or above the high water map word, and claims the run
+ */
+static void *
+mballoc_slab(mbspace_t *space, int n, mbword_t smask)
+{
+    int     wi;
+    uint16  mi;
+
+    if ((mi = space->slabhead[n]) == MB_SLAB_NIL) {
+        if ((mi = space->slabhead[0]) != MB_SLAB_NIL) {
+            mbslabunlink(space, mi, 0);
+        } else {
+            /* skip map words used above the high water map word, they join the lists when freed */
+            for (; space->hwm < space->mapwords && mbmapget(space, space->hwm); space->hwm++) {
+                space->slabcls[space->hwm] = MB_SLAB_MIXED;
+            }
+            if (space->hwm == space->mapwords) {
+                MB_DEBUG_PRINT("No slab map word found for %d nibbles!\n", n);
+                mbcur->err = MBERR_NOMEM;
+                return NULL;
+            }
+            mi = space->hwm++;
+        }
+        space->slabcls[mi] = n;
+    }
+
+    wi = mbspacefit(space, mbmapget(space, mi), smask);
+    mbrunclaim(space, mi, wi, smask);
+
+    mbcur->err = MBERR_OK;
+    return &space->block[(mi * space->bytes_perword) + (wi * space->bytes_pernib)];
+}
+
+
+/**
+ * \brief
+ * Allocate a run from the fullness buckets
+ *
+ * \details
+ * Tries a few map words of each bucket from the fewest free nibbles the run
+ * needs up, then an empty map word, and only then every partly used map word,
+ * so that small runs fill nearly full map words and leave empty ones for long runs
+ */
+static void *
+mballoc_full(mbspace_t *space, int n, mbword_t smask)
+{
+    int     k, wi, probes, pass;
+    uint16  mi;
+
+    for (pass = 0; pass < 2; pass++) {
+        for (k = n; k < MB_MAP_NIB_PERWORD; k++) {
+            probes = pass ? space->mapwords : MB_FULL_PROBES;
+            for (mi = space->slabhead[k]; mi != MB_SLAB_NIL && probes-- > 0; mi = space->slabnext[mi]) {
+                if ((wi = mbspacefit(space, mbmapget(space, mi), smask)) >= 0) {
+                    goto found;
+                }
+            }
+        }
+
+        if ((mi = space->slabhead[MB_MAP_NIB_PERWORD]) == MB_SLAB_NIL) {
+            /* map words used above the high water map word join their buckets as it passes */
+            for (; space->hwm < space->mapwords && mbmapget(space, space->hwm); space->hwm++) {
+                space->slabcls[space->hwm] = 0;
+                mbfullset(space, space->hwm, mbmapget(space, space->hwm));
+            }
+            if (space->hwm < space->mapwords) {
+                mi = space->hwm++;
+                space->slabcls[mi] = 0;
+            }
+        }
+        if (mi != MB_SLAB_NIL) {
+            wi = mbspacefit(space, mbmapget(space, mi), smask);
+            goto found;
+        }
+    }
+
+    MB_DEBUG_PRINT("No map word found for %d nibbles!\n", n);
+    mbcur->err = MBERR_NOMEM;
+    return NULL;
+
+found:
+    mbrunclaim(space, mi, wi, smask);
+
+    mbcur->err = MBERR_OK;
+    return &space->block[(mi * space->bytes_perword) + (wi * space->bytes_pernib)];
+}
+
+
+/**
+ * \brief
+ * Allocate a run with next fit
+ *
+ * \details
+ * Scans the map from the current map word, and leaves the map word claimed
+ * from as the current map word. A run longer than the free run left in the
+ * current map word starts at the next one, so short runs filling a map word do
+ * not make longer runs rescan it. This stands in for a next fit index per run
+ * length, which lets each length sweep the space on its own and searches
+ * several times more map words on the mbsoak workload.
+ */
+static void *
+mballoc_next(mbspace_t *space, int n, mbword_t smask)
+{
+    int     wi;
+    uint16  mi, start;
+
+    /* Runs longer than the free run left in the current map word start at the next one */
+    start = (n <= space->mifit) ? space->mi : mbimapinc(space->mi, space->mapwords);
+
+    /* Scan left to right through word map with alloc mask for space */
+    mi = start;
+    while (space->scanned++, (wi = mbspacefit(space, mbmapget(space, mi), smask)) < 0) {
+        mi = mbimapinc(mi, space->mapwords);
+        /* if back to where the serch started then no space */
+        if (mi == start) {
+            MB_DEBUG_PRINT("No space found for %d nibbles!\n", n);
+            mbcur->err = MBERR_NOMEM;
+            return NULL;
+        }
+    }
+
+    /* Mark space allocated on map and keep the free run left in the map word */
+    mbrunclaim(space, mi, wi, smask);
+    space->mi = mi;
+    space->mifit = mbspacerun(space, space->bmap[mi]);
+
+    mbcur->err = MBERR_OK;
+    return &space->block[(mi * space->bytes_perword) + (wi * space->bytes_pernib)];
+}
+
+
+/**
+ * \brief
+ * Allocate a run from borrowed big block map words
+ *
+ * \details
+ * Tries the big block map words the small block space already borrowed, then
+ * borrows an empty one from the top of the big block space, set up as a small
+ * block space of its own. Nothing is borrowed inside an allocation transaction.
+ */
+static void *
+mballoc_borrow(int n, mbword_t smask)
+{
+    int         i, wi;
+    long        mi;
+    mbspace_t   *space, *big;
+    mbborrow_t  *slot;
+
+    slot = NULL;
+    for (i=0; i < mbcur->nborrow; i++) {
+        space = &mbcur->borrow[i].space;
+        if (space->block == NULL) {
+            slot = slot ? slot : &mbcur->borrow[i];
+            continue;
+        }
+        for (mi=0; mi < space->mapwords; mi++) {
+            if ((wi = mbwordclaim(space, mi, smask)) >= 0) {
+                mbcur->err = MBERR_OK;
+                return &space->block[(mi * space->bytes_perword) + (wi * space->bytes_pernib)];
+            }
+        }
+    }
+    big = &mbcur->space[MB_BIGBLOCKS];
+    if (slot == NULL || mbcur->tx.active || big->freenibs < big->reserve + MB_MAP_NIB_PERWORD) {
+        mbcur->err = MBERR_NOMEM;
+        return NULL;
+    }
+
+    for (mi = big->mapwords - 1; mi >= 0; mi--) {
+        if (mbmapget(big, mi) == 0 && mbwordclaim(big, mi, MB_MAP_RUNMASK(MB_MAP_NIB_PERWORD)) >= 0) {
+            break;
+        }
+    }
+    if (mi < 0) {
+        mbcur->err = MBERR_NOMEM;
+        return NULL;
+    }
+
+    /* the borrowed map word is a small block space with the settings of the small block space */
+    space = &slot->space;
+    memcpy(space, &mbcur->space[MB_SMALLBLOCKS], sizeof(mbspace_t));
+    memset(slot->map, 0, sizeof(slot->map));
+    memset(slot->gen, 0, sizeof(slot->gen));
+    slot->bmi = mi;
+    space->mapwords = MB_BORROW_MAPWORDS;
+    space->mi = 0;
+    space->mifit = MB_MAP_NIB_PERWORD;
+    space->lmi = 0;
+    space->smi = MB_BORROW_MAPWORDS - 1;
+    space->curgen = 0;
+    space->bmap = slot->map;
+    space->gen = slot->gen;
+    space->refcnt = mbcur->space[MB_SMALLBLOCKS].refcnt ? slot->refcnt : NULL;
+    space->policy = MB_POLICY_NEXTFIT;
+    space->slabcls = NULL;
+    space->freenibs = MB_BORROW_MAPWORDS * MB_MAP_NIB_PERWORD;
+    space->reserve = 0;
+    space->block = &big->block[mi * big->bytes_perword];
+    mbcur->borrowed++;
+    MB_DEBUG_PRINT("Borrowed big block map word %ld\n", mi);
+
+    wi = mbwordclaim(space, 0, smask);
+    mbcur->err = MBERR_OK;
+    return &space->block[wi * space->bytes_pernib];
+}
+
+
+/**
+ * \brief
+ * Allocate memory block space, with or without the reserve
+ *
+ * \details
+ * Rounds the given size up to the closest block size in the
+ * appropriate block space, and marks that space used on the
+ * corresponding space map. Only priority allocations may leave
+ * fewer free nibbles in the space than its reserve.
+ */
+static void *
+mballoc_res(unsigned long size, int prio)
+{
+    int         nwords, denied;
+    mbword_t    smask;          /* start mask */
+    mbspace_t   *space;
+    void        *ret;
+
+    space = mbspacefor(size);
+
+    /* if no pace found return NULL */
+    if (space == NULL) {
+        MB_DEBUG_PRINT("Cannot allocate %d bytes, only up to %d bytes at a time\n",
+                       size, (int)(MB_BBMAP_BYTES_PERWORD));
+        mbcur->err = MBERR_BIG;
+        return NULL;
+    }
+
+    if (mbcur->tx.active && mbcur->tx.n >= MB_TX_LOG_RUNS) {
+        MB_DEBUG_PRINT("Transaction log full, cannot allocate %lu bytes\n", size);
+        mbcur->err = MBERR_TX;
+        return NULL;
+    }
+
+    nwords = mbrunlen(space, size);
+
+    /* generate allocation mask to use */
+    smask = MB_MAP_RUNMASK(nwords);
+
+    denied = !prio && space->freenibs < space->reserve + nwords;
+    if (denied) {
+        MB_DEBUG_PRINT("Keeping the reserve, cannot allocate %lu bytes\n", size);
+        mbcur->err = MBERR_NOMEM;
+        ret = NULL;
+    } else if (space->policy == MB_POLICY_SLAB) {
+        ret = mballoc_slab(space, nwords, smask);
+    } else if (space->policy == MB_POLICY_FULLEST) {
+        ret = mballoc_full(space, nwords, smask);
+    } else if (space->policy != MB_POLICY_NEXTFIT) {
+        ret = mballoc_idx(space, nwords, smask);
+    } else {
+        ret = mballoc_next(space, nwords, smask);
+    }
+
+    /* a full small block space borrows empty big block map words */
+    if (ret == NULL && mbcur->nborrow && space == &mbcur->space[MB_SMALLBLOCKS]) {
+        ret = mballoc_borrow(nwords, smask);
+    }
+
+    /* count the use of the reserve, blocks in borrowed map words do not use it */
+    if (ret == NULL && denied) {
+        space->resdenied++;
+    } else if (prio && ret != NULL && space->freenibs < space->reserve && mbspaceof(ret) == space) {
+        space->resprio++;
+        if (space->reserve - space->freenibs > space->respeak) {
+            space->respeak = space->reserve - space->freenibs;
+        }
+    }
+    MB_DEBUG_PRINT("Allocating %d words for %lu bytes at %p smask %.8X\n", nwords, size, ret, smask);
+    return ret;
+}
+
+
+/**
+ * \brief
+ * Allocate memory block space
+ *
+ * \details
+ * Rounds the given size up to the closest block size in the
+ * appropriate block space, and marks that space used on the
+ * corresponding space map. The reserve of the space is left
+ * for mballoc_prio().
+ *
+ * \param[in] size    number of bytes requested
+ *
+ * \returns   pointer to bytes allocate or NULL if not available
+ *            If NULL returned check mberr code for reason
+ */
+void *
+mballoc(unsigned long size)
+{
+    return mballoc_res(size, 0);
+}
+
+
+/**
+ * \brief
+ * Allocate memory block space for a priority path
+ *
+ * \details
+ * Same as mballoc() but may also allocate the reserve of the space
+ *
+ * \param[in] size    number of bytes requested
+ *
+ * \returns   pointer to bytes allocate or NULL if not available
+ *            If NULL returned check mberr code for reason
+ */
+void *
+mballoc_prio(unsigned long size)
+{
+    return mballoc_res(size, 1);
+}
+
+
+/**
+ * \brief
+ * Allocate memory block space near a hint
+ *
+ * \details
+ * Same as mballoc() but first searches the map word of the hint block, then its
+ * neighbor map words, then the other map words of the hint's page, so that
+ * related blocks share cache lines and pages. Falls back to mballoc() if none
+ * has room or the hint is not in the space the size is allocated from.
+ * The allocation cursor of the space is not moved.
+ *
+ * \param[in] size    number of bytes requested
+ * \param[in] hint    block to allocate near, or NULL
+ *
+ * \returns   pointer to bytes allocate or NULL if not available
+ *            If NULL returned check mberr code for reason
+ */
+void *
+mballoc_near(unsigned long size, void *hint)
+{
+    int         nwords, wi;
+    long        mi, d, lo, hi, pg;
+    mbword_t    smask;
+    mbspace_t   *space;
+
+    space = mbspacefor(size);
+    if (space == NULL || hint == NULL || mbspaceof(hint) != space ||
+        space->policy == MB_POLICY_SLAB ||
+        (mbcur->tx.active && mbcur->tx.n >= MB_TX_LOG_RUNS)) {
+        return mballoc(size);
+    }
+
+    nwords = mbrunlen(space, size);
+    smask = MB_MAP_RUNMASK(nwords);
+    if (space->freenibs < space->reserve + nwords) {
+        return mballoc(size);
+    }
+
+    /* map words holding the hint's page */
+    mi = ((mbbyte_t *)hint - space->block) / space->bytes_perword;
+    pg = (long)((unsigned long)hint & ~(unsigned long)(MB_NEAR_PAGE - 1)) - (long)space->block;
+    lo = pg < 0 ? 0 : pg / space->bytes_perword;
+    hi = (pg + MB_NEAR_PAGE + space->bytes_perword - 1) / space->bytes_perword;
+
+    /* hint word, then outward over its neighbors and the rest of its page */
+    wi = -1;
+    for (d = 0; d <= 1 || mi - d >= lo || mi + d < hi; d++) {
+        if ((d <= 1 || mi - d >= lo) && (wi = mbwordclaim(space, mi - d, smask)) >= 0) {
+            mi -= d;
+            break;
+        }
+        if (d && (d <= 1 || mi + d < hi) && (wi = mbwordclaim(space, mi + d, smask)) >= 0) {
+            mi += d;
+            break;
+        }
+    }
+    if (wi < 0) {
+        return mballoc(size);
+    }
+
+    mbcur->err = MBERR_OK;
+    return &space->block[(mi * space->bytes_perword) + (wi * space->bytes_pernib)];
+}
+
+
+/**
+ * \brief
+ * Allocate memory block space with a lifetime hint
+ *
+ * \details
+ * Same as mballoc() but places long lived blocks from the first map word of the
+ * space upward and short lived blocks from the last map word downward, each
+ * with its own map index, so that short lived churn does not split the map
+ * words of long lived blocks. The boundary between the two follows demand, as
+ * freed map words move the index of their end back.
+ *
+ * \param[in] size      number of bytes requested
+ * \param[in] lifetime  MB_LIFETIME_SHORT or MB_LIFETIME_LONG
+ *
+ * \returns   pointer to bytes allocate or NULL if not available
+ *            If NULL returned check mberr code for reason
+ */
+void *
+mballoc_hint(unsigned long size, int lifetime)
+{
+    int         nwords, wi;
+    uint16      mi, *cur;
+    mbword_t    smask;
+    mbspace_t   *space;
+
+    space = mbspacefor(size);
+    if (space == NULL || (lifetime != MB_LIFETIME_SHORT && lifetime != MB_LIFETIME_LONG) ||
+        space->policy == MB_POLICY_SLAB ||
+        (mbcur->tx.active && mbcur->tx.n >= MB_TX_LOG_RUNS)) {
+        return mballoc(size);
+    }
+
+    nwords = mbrunlen(space, size);
+    smask = MB_MAP_RUNMASK(nwords);
+    if (space->freenibs < space->reserve + nwords) {
+        return mballoc(size);
+    }
+
+    /* Scan away from the end of the space for the lifetime */
+    cur = (lifetime == MB_LIFETIME_LONG) ? &space->lmi : &space->smi;
+    mi = *cur;
+    while ((wi = mbspacefit(space, mbmapget(space, mi), smask)) < 0) {
+        mi = (lifetime == MB_LIFETIME_LONG) ? mbimapinc(mi, space->mapwords) :
+                                              mbimapdec(mi, space->mapwords);
+        if (mi == *cur) {
+            MB_DEBUG_PRINT("No space found for %lu bytes!\n", size);
+            mbcur->err = MBERR_NOMEM;
+            return NULL;
+        }
+    }
+
+    mbrunclaim(space, mi, wi, smask);
+    *cur = mi;
+
+    mbcur->err = MBERR_OK;
+    return &space->block[(mi * space->bytes_perword) + (wi * space->bytes_pernib)];
+}
+
+
+/**
+ * \brief
+ * Free memory allocated by mballoc
+ *
+ * \details
+ * Frees all the memory that was allocated starting from this address.
+ * Do not pass in an address that was not returned from mballoc().
+ * If the address given is not in the memory spaces it is passed to the
+ * fallback free set with mbsetfallback(), or mberr will be set if there is none.
+ *
+ * \param[in]   mbp     memory block pointer
+ *
+ * \note
+ * If there is a problem freeing the mblib mberr will be set
+ */
+void
+mbfree(void *mbp)
+{
+    uint16      mi, wi;
+    mbspace_t   *space;
+
+    MB_DEBUG_PRINT("Trying to free memory at %p\n", mbp);
+
+    /* Find which space the memory being freed is in */
+    space = mbspaceof(mbp);
+    if (space == NULL) {
+        if (mbcur->fallback != NULL && mbp != NULL) {
+            MB_DEBUG_PRINT("Forwarding free of memory not owned by mblib at %p\n", mbp);
+            mbcur->fallback(mbp);
+            return;
+        }
+        MB_DEBUG_PRINT("Tried to free memory not owned by mblib at %p\n", mbp);
+        mbcur->err = MBERR_UNKNOWN;
+        return;
+    }
+
+    mbptrloc(space, mbp, &mi, &wi);
+    if (mbrunfree(space, mi, wi) == 0) {
+        mbcur->err = MBERR_MAPCORRUPT;
+        return;
+    }
+    mbborrowret(space);
+    MB_DEBUG_PRINT("Freed memory at space %d mi %d wi %d\n", (int)(space - mbcur->space), mi, wi);
+}
+
+/**
+ * \brief
+ * Free all memory blocks
+ *
+ * \details
+ * Invalidates all allocations by moving the spaces on to a new map generation
+ * instead of clearing the maps. Map words of an older generation are treated as
+ * empty, and are cleared the next time they are used. This takes constant time
+ * except in first and best fit spaces, whose run index is cleared in time
+ * proportional to the number of map words. All memory block pointers and
+ * handles become invalid.
+ */
+void
+mbreset(void)
+{
+    int         i;
+    mbspace_t   *space;
+
+    for (i=0, space = mbcur->space; i < MB_SPACES; i++, space++) {
+        /* clear the maps when the generation wraps so old words are not current again */
+        if (++space->curgen == 0) {
+            memset(space->bmap, 0, space->mapwords * MB_MAPWORD_SIZE);
+            memset(space->gen, 0, space->mapwords * sizeof(uint16));
+        }
+        space->mi = 0;
+        space->mifit = MB_MAP_NIB_PERWORD;
+        space->lmi = 0;
+        space->smi = space->mapwords - 1;
+        space->freenibs = space->mapwords * MB_MAP_NIB_PERWORD;
+
+        /* every map word is empty, so only the 8 nibble run bitmap is set */
+        if (space->policy == MB_POLICY_FIRSTFIT || space->policy == MB_POLICY_BESTFIT) {
+            memset(space->runidx, 0, space->mapwords);
+            memset(&space->runidx[(MB_MAP_NIB_PERWORD - 1) * (space->mapwords >> 5)], 0xFF,
+                   space->mapwords >> 3);
+        }
+        if (space->policy == MB_POLICY_SLAB || space->policy == MB_POLICY_FULLEST) {
+            mbslabbuild(space, 1);
+        }
+    }
+
+    /* borrowed big block map words are empty with the rest of the big block space */
+    for (i=0; i < mbcur->nborrow; i++) {
+        mbcur->borrow[i].space.block = NULL;
+    }
+    mbcur->borrowed = 0;
+
+    /* child instances are freed back with the rest of the big block space */
+    mbfreechildren(mbcur);
+
+    mbcur->htab.used = 0;
+    mbcur->htab.free = 0;
+    mbcur->htab.cur = 0;
+    mbcur->tx.active = 0;
+    mbcur->err = MBERR_OK;
+}
+
+/**
+ * \brief
+ * Begin an allocation transaction
+ *
+ * \details
+ * Blocks allocated until the transaction is committed or aborted are logged,
+ * so that mbtx_abort() can free all of them in one pass over the log.
+ * Transactions do not nest. Allocation fails with MBERR_TX when the log is full.
+ *
+ * \note
+ * If a transaction is already active mberr will be set
+ */
+void
+mbtx_begin(void)
+{
+    if (mbcur->tx.active) {
+        mbcur->err = MBERR_TX;
+        return;
+    }
+    mbcur->tx.active = 1;
+    mbcur->tx.n = 0;
+    mbcur->err = MBERR_OK;
+}
+
+
+/**
+ * \brief
+ * Commit an allocation transaction
+ *
+ * \details
+ * Keeps all blocks allocated in the transaction and discards the log
+ */
+void
+mbtx_commit(void)
+{
+    mbcur->tx.active = 0;
+    mbcur->tx.n = 0;
+}
+
+
+/**
+ * \brief
+ * Abort an allocation transaction
+ *
+ * \details
+ * Frees all blocks allocated in the transaction by clearing their logged
+ * runs from the maps. Blocks freed in the transaction stay free. Handles of
+ * blocks allocated in the transaction point at free runs then, so they are
+ * freed as well.
+ */
+void
+mbtx_abort(void)
+{
+    int         i;
+    uint16      mi, wi;
+    mbtxent_t   *txent;
+    mbhent_t    *ent;
+    mbspace_t   *space;
+
+    if (!mbcur->tx.active) {
+        return;
+    }
+    for (i=0, txent = mbcur->tx.log; i < mbcur->tx.n; i++, txent++) {
+        mbmapset(txent->space, txent->mi, txent->space->bmap[txent->mi] & ~txent->nibs);
+        mbborrowret(txent->space);
+    }
+
+    /* handles allocated before the transaction keep blocks that are still allocated */
+    for (i=0, ent = mbcur->htab.ent; i < mbcur->htab.used; i++, ent++) {
+        if (ent->ptr != NULL && (space = mbspaceof(ent->ptr)) != NULL) {
+            mbptrloc(space, ent->ptr, &mi, &wi);
+            if (mbnibval(mbmapget(space, mi), wi) == 0) {
+                ent->ptr = NULL;
+                ent->next = mbcur->htab.free;
+                mbcur->htab.free = i + 1;
+            }
+        }
+    }
+    MB_DEBUG_PRINT("Transaction aborted, freed %d runs\n", mbcur->tx.n);
+    mbtx_commit();
+}
+
+/**
+ * \brief
+ * Free a batch of memory blocks
+ *
+ * \details
+ * Frees each of the n memory blocks in the array as mbfree() does.
+ * NULL entries are skipped.
+ *
+ * \param[in]   mbp     array of memory block pointers
+ * \param[in]   n       number of memory block pointers in the array
+ */
+void
+mbfree_n(void **mbp, int n)
+{
+    int i;
+
+    for (i=0; i < n; i++) {
+        if (mbp[i] != NULL) {
+            mbfree(mbp[i]);
+        }
+    }
+}
+
+
+/**
+ * \brief
+ * Allocate memory block space as a compressed offset
+ *
+ * \param[in] size    number of bytes requested
+ *
+ * \returns   offset of the block or MB_OFF_NULL if not available
+ *            If MB_OFF_NULL returned check mberr code for reason
+ */
+mboff_t
+mballoc_off(unsigned long size)
+{
+    void *mbp;
+
+    if ((mbp = mballoc(size)) == NULL) {
+        return MB_OFF_NULL;
+    }
+    return mbptr2off(mbp);
+}
+
+
+/**
+ * \brief
+ * Free a memory block by its compressed offset
+ *
+ * \param[in]   off     offset returned by mballoc_off() or mbptr2off()
+ */
+void
+mbfree_off(mboff_t off)
+{
+    if (off == MB_OFF_NULL) {
+        mbcur->err = MBERR_UNKNOWN;
+        return;
+    }
+    mbfree(mboff2ptr(off));
+}
+
+
+/**
+ * \brief
+ * Initialize a scoped bump arena
+ *
+ * \param[out]  arena   arena to initialize
+ */
+void
+mbarena_init(mbarena_t *arena)
+{
+    memset(arena, 0, sizeof(*arena));
+}
+
+
+/**
+ * \brief
+ * Allocate memory from a scoped bump arena
+ *
+ * \details
+ * Carves the memory from the current arena run by bumping a pointer, with no
+ * map update per allocation. When the run has no room a new big block space run
+ * is taken, a full map word (2048 bytes) if one is free, or else a run just big
+ * enough for the allocation. Allocations are rounded up to 16 bytes, and 0 bytes
+ * to 16 bytes.
+ *
+ * \param[in]   arena   arena to allocate from
+ * \param[in]   size    number of bytes requested
+ *
+ * \returns     pointer to bytes allocated or NULL if not available
+ *              If NULL returned check mberr code for reason
+ */
+void *
+mbarena_alloc(mbarena_t *arena, unsigned long size)
+{
+    unsigned long   runsize;
+    void            *ret;
+
+    if (size > MB_BBMAP_BYTES_PERWORD) {
+        mbcur->err = MBERR_BIG;
+        return NULL;
+    }
+
+    /* empty allocations still take 16 bytes, so that each gets its own pointer */
+    size = (size ? size + MB_ARENA_ALIGN - 1 : MB_ARENA_ALIGN) & ~(unsigned long)(MB_ARENA_ALIGN - 1);
+    if (size > arena->left) {
+        if (arena->nruns >= MB_ARENA_RUNS) {
+            MB_DEBUG_PRINT("Arena %p has no runs left\n", arena);
+            mbcur->err = MBERR_NOMEM;
+            return NULL;
+        }
+
+        /* take a full map word, or else only the run the allocation needs, keeping the error of mballoc() */
+        runsize = MB_BBMAP_BYTES_PERWORD;
+        if ((ret = mballoc(runsize)) == NULL && mbcur->err == MBERR_NOMEM && size < runsize) {
+            runsize = (size + MB_BBMAP_BYTES_PERNIB - 1) & ~(unsigned long)(MB_BBMAP_BYTES_PERNIB - 1);
+            ret = mballoc(runsize);
+        }
+        if (ret == NULL) {
+            return NULL;
+        }
+        arena->run[arena->nruns++] = ret;
+        arena->cur = ret;
+        arena->left = runsize;
+    }
+
+    ret = arena->cur;
+    arena->cur += size;
+    arena->left -= size;
+    mbcur->err = MBERR_OK;
+    return ret;
+}
+
+
+/**
+ * \brief
+ * Release all memory of a scoped bump arena
+ *
+ * \details
+ * Frees all the arena runs at once with mbfree_n(). The arena may be used
+ * again afterwards.
+ *
+ * \param[in]   arena   arena to release
+ */
+void
+mbarena_release(mbarena_t *arena)
+{
+    mbfree_n(arena->run, arena->nruns);
+    mbarena_init(arena);
+}
+
+/**
+ * \brief
+ * Get the reference count of a memory block
+ *
+ * \details
+ * Returns a pointer to the reference count of the block in the side array of
+ * its space, and sets the space and map location of the block. Returns NULL and
+ * sets mberr if reference counts are not kept or the block is unknown.
+ */
+static uint16 *
+mbrefcnt(void *mbp, mbspace_t **space, uint16 *mi, uint16 *wi)
+{
+    if ((*space = mbspaceof(mbp)) == NULL) {
+        mbcur->err = MBERR_UNKNOWN;
+        return NULL;
+    }
+    if ((*space)->refcnt == NULL) {
+        mbcur->err = MBERR_CONFIG;
+        return NULL;
+    }
+    mbptrloc(*space, mbp, mi, wi);
+    return &(*space)->refcnt[(*mi * MB_MAP_NIB_PERWORD) + *wi];
+}
+
+
+/**
+ * \brief
+ * Allocate a reference counted memory block
+ *
+ * \details
+ * Allocates a block with mballoc() with a reference count of 1. The count is
+ * kept in a side array indexed by map nibble, so the block has no header.
+ * The instance must be configured with refs set.
+ *
+ * \param[in] size    number of bytes requested
+ *
+ * \returns   pointer to bytes allocate or NULL if not available
+ *            If NULL returned check mberr code for reason
+ */
+void *
+mbref_alloc(unsigned long size)
+{
+    void        *mbp;
+    uint16      mi, wi, *cnt;
+    mbspace_t   *space;
+
+    if (mbcur->space[MB_SMALLBLOCKS].refcnt == NULL) {
+        mbcur->err = MBERR_CONFIG;
+        return NULL;
+    }
+    if ((mbp = mballoc(size)) == NULL) {
+        return NULL;
+    }
+    cnt = mbrefcnt(mbp, &space, &mi, &wi);
+    __atomic_store_n(cnt, 1, __ATOMIC_RELEASE);
+    return mbp;
+}
+
+
+/**
+ * \brief
+ * Take a reference to a reference counted memory block
+ *
+ * \details
+ * The reference count is updated atomically, so references may be taken and
+ * put from any thread. A block has at most 65535 references, and taking one
+ * more fails rather than wrap the count.
+ *
+ * \param[in]   mbp     memory block pointer returned by mbref_alloc()
+ *
+ * \return
+ * 1 if the reference is taken
+ * 0 if the block is not reference counted or has 65535 references, mberr is set
+ */
+int
+mbref_get(void *mbp)
+{
+    uint16      mi, wi, old, *cnt;
+    mbspace_t   *space;
+
+    if ((cnt = mbrefcnt(mbp, &space, &mi, &wi)) == NULL) {
+        return 0;
+    }
+    old = __atomic_load_n(cnt, __ATOMIC_RELAXED);
+    do {
+        if (old == 0xFFFF) {
+            mbcur->err = MBERR_REFS;
+            return 0;
+        }
+    } while (!__atomic_compare_exchange_n(cnt, &old, old + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    return 1;
+}
+
+
+/**
+ * \brief
+ * Put a reference to a reference counted memory block
+ *
+ * \details
+ * Frees the block when the last reference is put. The reference count is
+ * updated atomically, but freeing the block updates the space map, so calls
+ * that allocate and free must still not run at the same time.
+ *
+ * \param[in]   mbp     memory block pointer returned by mbref_alloc()
+ */
+void
+mbref_put(void *mbp)
+{
+    uint16      mi, wi, *cnt;
+    mbspace_t   *space;
+
+    if ((cnt = mbrefcnt(mbp, &space, &mi, &wi)) == NULL) {
+        return;
+    }
+    if (__atomic_sub_fetch(cnt, 1, __ATOMIC_ACQ_REL) == 0) {
+        /* the map location is known, so free the run directly */
+        if (mbrunfree(space, mi, wi) == 0) {
+            mbcur->err = MBERR_MAPCORRUPT;
+            return;
+        }
+        mbborrowret(space);
+    }
+}
+
+
+/**
+ * \brief
+ * Get the number of references to a reference counted memory block
+ *
+ * \param[in]   mbp     memory block pointer returned by mbref_alloc()
+ *
+ * \return      number of references, or 0 if the block is unknown
+ */
+int
+mbref_count(void *mbp)
+{
+    uint16      mi, wi, *cnt;
+    mbspace_t   *space;
+
+    if ((cnt = mbrefcnt(mbp, &space, &mi, &wi)) == NULL) {
+        return 0;
+    }
+    return __atomic_load_n(cnt, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * \brief
+ * Initialize a chained buffer
+ *
+ * \param[out]  chain   chained buffer to initialize
+ */
+void
+mbchain_init(mbchain_t *chain)
+{
+    memset(chain, 0, sizeof(*chain));
+}
+
+
+/**
+ * \brief
+ * Get the bytes a chain segment can still take
+ *
+ * \details
+ * Only a block that no other chain references can take more bytes
+ */
+static unsigned long
+mbchain_room(mbseg_t *seg)
+{
+    if (seg->len && mbref_count(seg->blk) != 1) {
+        return 0;
+    }
+    return MB_CHAIN_BLKSIZE - seg->off - seg->len;
+}
+
+
+/**
+ * \brief
+ * Find the chain segment where bytes are added
+ *
+ * \details
+ * Returns the index of the last segment holding bytes if it has room, else of
+ * the first empty segment after it, or the number of segments if there is none
+ */
+static int
+mbchain_tail(mbchain_t *chain)
+{
+    int i;
+
+    for (i = chain->nsegs; i > 0 && chain->seg[i - 1].len == 0; i--)
+        ;
+    if (i > 0 && mbchain_room(&chain->seg[i - 1])) {
+        return i - 1;
+    }
+    return i;
+}
+
+
+/**
+ * \brief
+ * Get the bytes that can still be added to a chain
+ *
+ * \details
+ * Sums the room of the segments from the tail on and of the segments left
+ */
+static unsigned long
+mbchain_left(mbchain_t *chain)
+{
+    int             t;
+    unsigned long   left;
+
+    left = (unsigned long)(MB_CHAIN_SEGS - chain->nsegs) * MB_CHAIN_BLKSIZE;
+    for (t = mbchain_tail(chain); t < chain->nsegs; t++) {
+        left += mbchain_room(&chain->seg[t]);
+    }
+    return left;
+}
+
+
+/**
+ * \brief
+ * Add an empty segment to the end of a chain
+ *
+ * \details
+ * Takes a new reference counted big block. Returns 0 and sets mberr if the
+ * chain has no segments left or there is no block available.
+ */
+static int
+mbchain_grow(mbchain_t *chain)
+{
+    mbseg_t *seg;
+    void    *blk;
+
+    if (chain->nsegs >= MB_CHAIN_SEGS) {
+        MB_DEBUG_PRINT("Chain %p has no segments left\n", chain);
+        mbcur->err = MBERR_NOMEM;
+        return 0;
+    }
+    if ((blk = mbref_alloc(MB_CHAIN_BLKSIZE)) == NULL) {
+        return 0;
+    }
+    seg = &chain->seg[chain->nsegs++];
+    seg->blk = blk;
+    seg->off = 0;
+    seg->len = 0;
+    return 1;
+}
+
+
+/**
+ * \brief
+ * Append bytes to a chained buffer
+ *
+ * \details
+ * Copies the bytes into the free room of the last block of the chain, and into
+ * new big blocks linked to the chain as needed. A chain has at most
+ * MB_CHAIN_SEGS blocks, so it holds at most MB_CHAIN_MAX (64 KiB) bytes. A
+ * payload that does not fit the room left is not appended, and mberr is set
+ * to MBERR_BIG.
+ *
+ * \param[in]   chain   chained buffer
+ * \param[in]   data    bytes to append
+ * \param[in]   len     number of bytes to append
+ *
+ * \return      number of bytes appended
+ *              If less than len check mberr code for reason
+ */
+unsigned long
+mbchain_append(mbchain_t *chain, const void *data, unsigned long len)
+{
+    int             t;
+    unsigned long   done, n;
+    mbseg_t         *seg;
+
+    if (len > mbchain_left(chain)) {
+        MB_DEBUG_PRINT("Chain %p has no room for %lu bytes\n", chain, len);
+        mbcur->err = MBERR_BIG;
+        return 0;
+    }
+
+    done = 0;
+    t = mbchain_tail(chain);
+    while (done < len) {
+        if (t == chain->nsegs && !mbchain_grow(chain)) {
+            return done;
+        }
+        seg = &chain->seg[t++];
+        n = mbchain_room(seg);
+        if (n > len - done) {
+            n = len - done;
+        }
+        memcpy(seg->blk + seg->off + seg->len, (const mbbyte_t *)data + done, n);
+        seg->len += n;
+        chain->len += n;
+        done += n;
+    }
+    mbcur->err = MBERR_OK;
+    return done;
+}
+
+
+/**
+ * \brief
+ * Consume bytes from the front of a chained buffer
+ *
+ * \details
+ * Drops the bytes without copying them, and puts the blocks that are emptied.
+ *
+ * \param[in]   chain   chained buffer
+ * \param[in]   len     number of bytes to consume
+ *
+ * \return      number of bytes consumed
+ */
+unsigned long
+mbchain_consume(mbchain_t *chain, unsigned long len)
+{
+    unsigned long   done;
+    mbseg_t         *seg;
+
+    done = 0;
+    seg = chain->seg;
+    while (done < len && chain->nsegs && seg->len) {
+        if (len - done < seg->len) {
+            seg->off += len - done;
+            seg->len -= len - done;
+            done = len;
+            break;
+        }
+        done += seg->len;
+        mbref_put(seg->blk);
+        memmove(seg, seg + 1, --chain->nsegs * sizeof(mbseg_t));
+    }
+    chain->len -= done;
+    return done;
+}
+
+
+/**
+ * \brief
+ * Slice a chained buffer
+ *
+ * \details
+ * Makes a new chain of len bytes starting at offset off of the source chain.
+ * The new chain references the same blocks, so no bytes are copied. Blocks shared
+ * by chains are not appended to.
+ *
+ * \param[in]   src     source chained buffer
+ * \param[in]   off     offset of the first byte of the slice
+ * \param[in]   len     number of bytes in the slice
+ * \param[out]  dst     chained buffer for the slice, initialized by this call
+ *
+ * \return      number of bytes in the slice
+ *              If less than len check mberr code for reason
+ */
+unsigned long
+mbchain_slice(const mbchain_t *src, unsigned long off, unsigned long len, mbchain_t *dst)
+{
+    int             i;
+    unsigned long   n;
+    const mbseg_t   *seg;
+
+    mbchain_init(dst);
+    mbcur->err = MBERR_OK;
+    for (i=0, seg = src->seg; i < src->nsegs && dst->len < len; i++, seg++) {
+        if (off >= seg->len) {
+            off -= seg->len;
+            continue;
+        }
+        if (dst->nsegs >= MB_CHAIN_SEGS) {
+            mbcur->err = MBERR_NOMEM;
+            break;
+        }
+        n = seg->len - off;
+        if (n > len - dst->len) {
+            n = len - dst->len;
+        }
+        if (!mbref_get(seg->blk)) {
+            break;
+        }
+        dst->seg[dst->nsegs].blk = seg->blk;
+        dst->seg[dst->nsegs].off = seg->off + off;
+        dst->seg[dst->nsegs].len = n;
+        dst->nsegs++;
+        dst->len += n;
+        off = 0;
+    }
+    return dst->len;
+}
+
+
+/**
+ * \brief
+ * Export a chained buffer as an iovec array
+ *
+ * \details
+ * Fills the iovec array with the bytes of the chain, for writev() or sendmsg().
+ *
+ * \param[in]   chain   chained buffer
+ * \param[out]  iov     iovec array
+ * \param[in]   max     number of entries in the iovec array
+ *
+ * \return      number of iovec entries filled
+ */
+int
+mbchain_iov(const mbchain_t *chain, struct iovec *iov, int max)
+{
+    int i, n;
+
+    for (i=0, n=0; i < chain->nsegs && n < max && chain->seg[i].len; i++, n++) {
+        iov[n].iov_base = chain->seg[i].blk + chain->seg[i].off;
+        iov[n].iov_len = chain->seg[i].len;
+    }
+    return n;
+}
+
+
+/**
+ * \brief
+ * Prepare a chained buffer to receive bytes
+ *
+ * \details
+ * Fills the iovec array with up to len bytes of free room at the end of the
+ * chain, linking new big blocks to the chain as needed, for readv() or recvmsg().
+ * The bytes received are added to the chain with mbchain_commit(). A payload
+ * that does not fit the room left of at most MB_CHAIN_MAX (64 KiB) bytes per
+ * chain fills no entries, and mberr is set to MBERR_BIG.
+ *
+ * \param[in]   chain   chained buffer
+ * \param[in]   len     number of bytes to receive
+ * \param[out]  iov     iovec array
+ * \param[in]   max     number of entries in the iovec array
+ *
+ * \return      number of iovec entries filled
+ */
+int
+mbchain_recv_iov(mbchain_t *chain, unsigned long len, struct iovec *iov, int max)
+{
+    int             t, n;
+    unsigned long   room;
+    mbseg_t         *seg;
+
+    if (len > mbchain_left(chain)) {
+        MB_DEBUG_PRINT("Chain %p has no room for %lu bytes\n", chain, len);
+        mbcur->err = MBERR_BIG;
+        return 0;
+    }
+
+    t = mbchain_tail(chain);
+    for (n=0; len && n < max; n++, t++) {
+        if (t == chain->nsegs && !mbchain_grow(chain)) {
+            break;
+        }
+        seg = &chain->seg[t];
+        room = mbchain_room(seg);
+        if (room > len) {
+            room = len;
+        }
+        iov[n].iov_base = seg->blk + seg->off + seg->len;
+        iov[n].iov_len = room;
+        len -= room;
+    }
+    return n;
+}
+
+
+/**
+ * \brief
+ * Add received bytes to a chained buffer
+ *
+ * \details
+ * Adds len bytes received into the iovec array filled by mbchain_recv_iov()
+ * to the chain.
+ *
+ * \param[in]   chain   chained buffer
+ * \param[in]   len     number of bytes received
+ */
+void
+mbchain_commit(mbchain_t *chain, unsigned long len)
+{
+    int             t;
+    unsigned long   n;
+    mbseg_t         *seg;
+
+    for (t = mbchain_tail(chain); len && t < chain->nsegs; t++) {
+        seg = &chain->seg[t];
+        n = mbchain_room(seg);
+        if (n > len) {
+            n = len;
+        }
+        seg->len += n;
+        chain->len += n;
+        len -= n;
+    }
+}
+
+
+/**
+ * \brief
+ * Free a chained buffer
+ *
+ * \details
+ * Puts all blocks of the chain. The chain may be used again afterwards.
+ *
+ * \param[in]   chain   chained buffer
+ */
+void
+mbchain_free(mbchain_t *chain)
+{
+    int i;
+
+    for (i=0; i < chain->nsegs; i++) {
+        mbref_put(chain->seg[i].blk);
+    }
+    mbchain_init(chain);
+}
+
+#ifdef __linux__
+/**
+ * \brief
+ * Register the block spaces with an io_uring instance
+ *
+ * \details
+ * Registers the block area of each space as an io_uring fixed buffer, with the
+ * space number as buffer index, so that reads and writes to blocks can use
+ * IORING_OP_READ_FIXED and IORING_OP_WRITE_FIXED with no page pinning per I/O.
+ * mburing_buf() gives the buffer index of a block.
+ *
+ * \param[in]   ringfd  io_uring file descriptor
+ *
+ * \return
+ * 1 if the block spaces are registered
+ * 0 if registration failed, mberr is set and errno has the reason
+ */
+int
+mburing_register(int ringfd)
+{
+    int             i;
+    struct iovec    iov[MB_SPACES];
+
+    for (i=0; i < MB_SPACES; i++) {
+        iov[i].iov_base = mbcur->space[i].block;
+        iov[i].iov_len = mbcur->space[i].mapwords * mbcur->space[i].bytes_perword;
+    }
+    if (syscall(__NR_io_uring_register, ringfd, IORING_REGISTER_BUFFERS, iov, MB_SPACES) < 0) {
+        MB_DEBUG_PRINT("io_uring buffer registration failed for ring %d\n", ringfd);
+        mbcur->err = MBERR_SYS;
+        return 0;
+    }
+    mbcur->err = MBERR_OK;
+    return 1;
+}
+
+
+/**
+ * \brief
+ * Unregister the block spaces from an io_uring instance
+ *
+ * \param[in]   ringfd  io_uring file descriptor
+ *
+ * \return
+ * 1 if the block spaces are unregistered
+ * 0 if unregistration failed, mberr is set and errno has the reason
+ */
+int
+mburing_unregister(int ringfd)
+{
+    if (syscall(__NR_io_uring_register, ringfd, IORING_UNREGISTER_BUFFERS, NULL, 0) < 0) {
+        mbcur->err = MBERR_SYS;
+        return 0;
+    }
+    mbcur->err = MBERR_OK;
+    return 1;
+}
+
+
+/**
+ * \brief
+ * Get the io_uring fixed buffer of a memory block
+ *
+ * \details
+ * Translates a memory block pointer to the fixed buffer index and offset
+ * registered by mburing_register(). Fixed buffer reads and writes take the
+ * block address itself along with the buffer index.
+ *
+ * \param[in]   mbp     memory block pointer
+ * \param[out]  bufidx  fixed buffer index
+ * \param[out]  off     offset of the block in the fixed buffer
+ *
+ * \return
+ * 1 if the memory is in a registered block space
+ * 0 if it is not
+ */
+int
+mburing_buf(void *mbp, unsigned int *bufidx, unsigned long *off)
+{
+    mbspace_t *space;
+
+    if ((space = mbspaceof(mbp)) == NULL) {
+        mbcur->err = MBERR_UNKNOWN;
+        return 0;
+    }
+    /* borrowed big block map words are in the big block buffer */
+    if (mbborrowof(space) != NULL) {
+        space = &mbcur->space[MB_BIGBLOCKS];
+    }
+    *bufidx = space - mbcur->space;
+    *off = (mbbyte_t *)mbp - space->block;
+    return 1;
+}
+
+/**
+ * \brief
+ * Initialize a mirrored byte ring
+ *
+ * \details
+ * Maps the ring memory twice back to back from a memfd, so that a record that
+ * runs past the end of the ring continues in the mirror and is always
+ * contiguous in virtual memory.
+ *
+ * \param[out]  ring    byte ring to initialize
+ * \param[in]   size    ring size in bytes, rounded up to a multiple of the page size
+ *
+ * \return
+ * 1 if the ring is initialized
+ * 0 if the ring could not be mapped, mberr is set and errno has the reason
+ */
+int
+mbring_init(mbring_t *ring, unsigned long size)
+{
+    int             fd;
+    unsigned long   page;
+    unsigned char   *buf;
+
+    memset(ring, 0, sizeof(*ring));
+    page = sysconf(_SC_PAGESIZE);
+    size = (size + page - 1) & ~(page - 1);
+
+    if ((fd = memfd_create("mbring", MFD_CLOEXEC)) < 0) {
+        mbcur->err = MBERR_SYS;
+        return 0;
+    }
+
+    /* reserve room for both mappings, then map the memfd over each half */
+    buf = mmap(NULL, size << 1, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buf == MAP_FAILED || ftruncate(fd, size) < 0 ||
+        mmap(buf, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+        mmap(buf + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        MB_DEBUG_PRINT("Cannot map byte ring of %lu bytes\n", size);
+        if (buf != MAP_FAILED) {
+            munmap(buf, size << 1);
+        }
+        close(fd);
+        mbcur->err = MBERR_SYS;
+        return 0;
+    }
+    close(fd);
+
+    ring->buf = buf;
+    ring->size = size;
+    mbcur->err = MBERR_OK;
+    return 1;
+}
+
+
+/**
+ * \brief
+ * Terminate a mirrored byte ring
+ *
+ * \param[in]   ring    byte ring to terminate
+ */
+void
+mbring_term(mbring_t *ring)
+{
+    if (ring->buf) {
+        munmap(ring->buf, ring->size << 1);
+    }
+    memset(ring, 0, sizeof(*ring));
+}
+
+
+/**
+ * \brief
+ * Reserve room for a record in a mirrored byte ring
+ *
+ * \details
+ * Returns contiguous room for a record of len bytes at the end of the ring.
+ * The record is added to the ring with mbring_commit().
+ *
+ * \param[in]   ring    byte ring
+ * \param[in]   len     number of bytes to reserve
+ *
+ * \return      pointer to the reserved room or NULL if the ring has no room
+ */
+void *
+mbring_reserve(mbring_t *ring, unsigned long len)
+{
+    if (len > ring->size - (ring->tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE))) {
+        mbcur->err = MBERR_NOMEM;
+        return NULL;
+    }
+    return ring->buf + (ring->tail % ring->size);
+}
+
+
+/**
+ * \brief
+ * Commit a record to a mirrored byte ring
+ *
+ * \param[in]   ring    byte ring
+ * \param[in]   len     number of bytes written in the room from mbring_reserve()
+ */
+void
+mbring_commit(mbring_t *ring, unsigned long len)
+{
+    __atomic_store_n(&ring->tail, ring->tail + len, __ATOMIC_RELEASE);
+}
+
+
+/**
+ * \brief
+ * Get the committed bytes of a mirrored byte ring
+ *
+ * \param[in]   ring    byte ring
+ * \param[out]  len     number of committed bytes
+ *
+ * \return      pointer to the committed bytes, which are contiguous
+ */
+void *
+mbring_peek(mbring_t *ring, unsigned long *len)
+{
+    *len = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) - ring->head;
+    return ring->buf + (ring->head % ring->size);
+}
+
+
+/**
+ * \brief
+ * Consume bytes from a mirrored byte ring
+ *
+ * \param[in]   ring    byte ring
+ * \param[in]   len     number of committed bytes to consume
+ */
+void
+mbring_consume(mbring_t *ring, unsigned long len)
+{
+    __atomic_store_n(&ring->head, ring->head + len, __ATOMIC_RELEASE);
+}
+#endif /* __linux__ */
+
+/**
+ * \brief
+ * Initialize a block channel
+ *
+ * \details
+ * Allocates the channel ring from the block spaces. The ring holds 32-bit
+ * block offsets from the start of the current instance, so the channel is only
+ * used with blocks of that instance.
+ *
+ * \param[out]  chan    channel to initialize
+ * \param[in]   slots   number of ring slots, rounded up to a power of 2
+ *                      and at most MB_CHAN_SLOTS
+ *
+ * \return
+ * 1 if the channel is initialized
+ * 0 if the ring could not be allocated, mberr is set
+ */
+int
+mbchan_init(mbchan_t *chan, int slots)
+{
+    unsigned int size;
+
+    memset(chan, 0, sizeof(*chan));
+    for (size = 1; size < slots && size < MB_CHAN_SLOTS; size <<= 1)
+        ;
+    if ((chan->ring = mballoc(size * sizeof(unsigned int))) == NULL) {
+        return 0;
+    }
+    chan->mask = size - 1;
+    chan->base = (unsigned char *)mbcur->space[MB_SMALLBLOCKS].bmap;
+    return 1;
+}
+
+
+/**
+ * \brief
+ * Terminate a block channel
+ *
+ * \details
+ * Frees the channel ring. Blocks still in the channel are not freed.
+ *
+ * \param[in]   chan    channel to terminate
+ */
+void
+mbchan_term(mbchan_t *chan)
+{
+    mbfree(chan->ring);
+    chan->ring = NULL;
+}
+
+
+/**
+ * \brief
+ * Send blocks on a block channel
+ *
+ * \details
+ * Transfers ownership of a batch of blocks to the receiver. Any number of
+ * threads may send on a channel. The slots of the batch are reserved first,
+ * and the batch is published in reservation order with one store.
+ *
+ * \param[in]   chan    channel to send on
+ * \param[in]   mbp     array of memory block pointers to send
+ * \param[in]   n       number of memory block pointers in the array
+ *
+ * \return      number of blocks sent, less than n if the ring is full
+ */
+int
+mbchan_send(mbchan_t *chan, void **mbp, int n)
+{
+    int             i;
+    unsigned int    r, room;
+
+    /* reserve ring slots for the batch */
+    r = __atomic_load_n(&chan->reserve, __ATOMIC_RELAXED);
+    do {
+        room = chan->mask + 1 - (r - __atomic_load_n(&chan->head, __ATOMIC_ACQUIRE));
+        if (n > room) {
+            n = room;
+        }
+        if (n == 0) {
+            return 0;
+        }
+    } while (!__atomic_compare_exchange_n(&chan->reserve, &r, r + n, 1,
+                                          __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+    for (i=0; i < n; i++) {
+        chan->ring[(r + i) & chan->mask] = (unsigned char *)mbp[i] - chan->base;
+    }
+
+    /* publish after the batches reserved before this one */
+    while (__atomic_load_n(&chan->tail, __ATOMIC_ACQUIRE) != r)
+        ;
+    __atomic_store_n(&chan->tail, r + n, __ATOMIC_RELEASE);
+    return n;
+}
+
+
+/**
+ * \brief
+ * Receive blocks from a block channel
+ *
+ * \details
+ * Takes ownership of a batch of blocks sent on the channel. Only one thread may
+ * receive from a channel. Received blocks can be freed together with mbfree_n().
+ *
+ * \param[in]   chan    channel to receive from
+ * \param[out]  mbp     array for the received memory block pointers
+ * \param[in]   max     number of entries in the array
+ *
+ * \return      number of blocks received
+ */
+int
+mbchan_recv(mbchan_t *chan, void **mbp, int max)
+{
+    int             i, n;
+    unsigned int    h;
+
+    h = chan->head;
+    n = __atomic_load_n(&chan->tail, __ATOMIC_ACQUIRE) - h;
+    if (n > max) {
+        n = max;
+    }
+    for (i=0; i < n; i++) {
+        mbp[i] = chan->base + chan->ring[(h + i) & chan->mask];
+    }
+    __atomic_store_n(&chan->head, h + n, __ATOMIC_RELEASE);
+    return n;
+}
+
+/**
+ * \brief
+ * Test if memory is owned by mblib
+ *
+ * \details
+ * Checks if the given address is in the block area of one of the memory spaces.
+ * This is an exact range check, so any pointer from another allocator is reported
+ * as not owned.
+ *
+ * \param[in]   mbp     memory pointer
+ *
+ * \return
+ * 1 if the memory is in an mblib block space
+ * 0 if it is not
+ */
+int
+mbowns(void *mbp)
+{
+    return (mbspaceof(mbp) != NULL);
+}
+
+
+/**
+ * \brief
+ * Set the placement policy of a space
+ *
+ * \details
+ * Sets how mballoc() picks the map word for blocks of the space that allocates
+ * the given size. The run index, slab lists or fullness buckets are rebuilt from
+ * the map when the space starts using them.
+ *
+ * \param[in]   size    block size allocated from the space
+ * \param[in]   policy  MB_POLICY_NEXTFIT, MB_POLICY_FIRSTFIT, MB_POLICY_BESTFIT,
+ *                      MB_POLICY_SLAB or MB_POLICY_FULLEST
+ *
+ * \return
+ * 1 if the policy is set
+ * 0 if the size or policy is not valid, mberr is set
+ */
+int
+mbpolicy_set(unsigned long size, int policy)
+{
+    mbspace_t *space;
+
+    if ((space = mbspacefor(size)) == NULL) {
+        mbcur->err = MBERR_BIG;
+        return 0;
+    }
+    if (policy < MB_POLICY_NEXTFIT || policy > MB_POLICY_FULLEST ||
+        (policy >= MB_POLICY_SLAB && space->slabcls == NULL)) {
+        mbcur->err = MBERR_CONFIG;
+        return 0;
+    }
+    if ((policy == MB_POLICY_FIRSTFIT || policy == MB_POLICY_BESTFIT) &&
+        space->policy != MB_POLICY_FIRSTFIT && space->policy != MB_POLICY_BESTFIT) {
+        space->policy = policy;
+        mbidxbuild(space);
+    }
+    if (policy == MB_POLICY_SLAB && space->policy != MB_POLICY_SLAB) {
+        space->policy = policy;
+        mbslabbuild(space, 0);
+    }
+    if (policy == MB_POLICY_FULLEST && space->policy != MB_POLICY_FULLEST) {
+        space->policy = policy;
+        mbfullbuild(space);
+    }
+    space->policy = policy;
+    mbcur->err = MBERR_OK;
+    return 1;
+}
+
+
+/**
+ * \brief
+ * Count the live runs of a space in a histogram
+ *
+ * \details
+ * Adds up the average live runs of each length for the sizes the space
+ * allocates with the given rounding mode, and the mean and variance of their
+ * live nibbles when the live block counts are Poisson
+ */
+static void
+mbhistruns(const mbhist_t *hist, int n, int sp, int round, double *runs, double *mean, double *var)
+{
+    int             i, len;
+    unsigned long   pernib;
+
+    pernib = (sp == MB_SMALLBLOCKS) ? MB_SBMAP_BYTES_PERNIB : MB_BBMAP_BYTES_PERNIB;
+    memset(runs, 0, (MB_MAP_NIB_PERWORD + 1) * sizeof(double));
+    *mean = *var = 0;
+    for (i=0; i < n; i++) {
+        if (sp != ((hist[i].size <= MB_SBMAP_BYTES_PERWORD) ? MB_SMALLBLOCKS : MB_BIGBLOCKS)) {
+            continue;
+        }
+        len = (hist[i].size + pernib - 1) / pernib;
+        len = mbrunround(len ? len : 1, round);
+        runs[len] += hist[i].live;
+        *mean += len * hist[i].live;
+        *var += len * len * hist[i].live;
+    }
+}
+
+
+/**
+ * \brief
+ * Round a non negative number up to a whole number
+ */
+static unsigned long
+mbceil(double x)
+{
+    return (unsigned long)x + ((double)(unsigned long)x < x);
+}
+
+
+/**
+ * \brief
+ * Get the square root of a non negative number
+ *
+ * \details
+ * Newton's method from above, which decreases until it converges, so that
+ * mblib does not need the math library
+ */
+static double
+mbsqrt(double x)
+{
+    double r, next;
+
+    if (x <= 0) {
+        return 0;
+    }
+    for (r = (x > 1) ? x : 1; (next = (r + x / r) / 2) < r; r = next)
+        ;
+    return r;
+}
+
+
+/**
+ * \brief
+ * Get the natural logarithm of a positive number
+ *
+ * \details
+ * Scales the number into [0.5, 1) by powers of 2, then sums the series of
+ * 2 atanh((x - 1) / (x + 1)), which converges quickly there
+ */
+static double
+mblog(double x)
+{
+    int     i, k;
+    double  u, term, sum;
+
+    for (k = 0; x < 0.5; k--) {
+        x *= 2;
+    }
+    for (; x >= 1; k++) {
+        x /= 2;
+    }
+    u = (x - 1) / (x + 1);
+    sum = 0;
+    for (i = 1, term = u; i < 40; i += 2, term *= u * u) {
+        sum += term / i;
+    }
+    return 2 * sum + k * 0.69314718055994531;
+}
+
+
+/**
+ * \brief
+ * Count the map words live runs pack into
+ *
+ * \details
+ * Packs the runs of each length into the partly used map word with the least
+ * room for them, longest runs first, opening map words as needed. Map words are
+ * counted by their free nibbles, so the packing takes constant time per length.
+ */
+static unsigned long
+mbpackwords(const double *runs)
+{
+    int             len, f, q;
+    unsigned long   c, m, full, words, open[MB_MAP_NIB_PERWORD];
+
+    memset(open, 0, sizeof(open));
+    words = 0;
+    for (len = MB_MAP_NIB_PERWORD; len > 0; len--) {
+        c = mbceil(runs[len]);
+        while (c > 0) {
+            for (f = len; f < MB_MAP_NIB_PERWORD && open[f] == 0; f++)
+                ;
+            if (f == MB_MAP_NIB_PERWORD) {
+                break;
+            }
+            m = (c < open[f]) ? c : open[f];
+            open[f] -= m;
+            open[f - len] += m;
+            c -= m;
+        }
+
+        /* new map words take as many runs as fit, the last one what is left */
+        q = MB_MAP_NIB_PERWORD / len;
+        full = c / q;
+        words += full;
+        open[MB_MAP_NIB_PERWORD - q * len] += full;
+        c -= full * q;
+        if (c > 0) {
+            words++;
+            open[MB_MAP_NIB_PERWORD - (int)c * len]++;
+        }
+    }
+    return words;
+}
+
+
+/**
+ * \brief
+ * Recommend an instance configuration for a workload
+ *
+ * \details
+ * Packs the runs of each space with each rounding mode and keeps the coarsest
+ * mode that needs no more map words than no rounding, then adds the headroom
+ * for the target NOMEM probability to the packed map words
+ */
+int
+mbautoconf(const mbhist_t *hist, int n, double nomem, mbconfig_t *config)
+{
+    int             i, sp, round, best, k, policy;
+    unsigned long   words, nonewords, bestwords;
+    double          t, z, mean, var, runs[MB_MAP_NIB_PERWORD + 1];
+
+    if (hist == NULL || n < 0 || config == NULL || !(nomem > 0)) {
+        mbcur->err = MBERR_CONFIG;
+        return 0;
+    }
+    for (i=0; i < n; i++) {
+        if (hist[i].size > MB_BBMAP_BYTES_PERWORD) {
+            mbcur->err = MBERR_BIG;
+            return 0;
+        }
+    }
+
+    /* one sided normal quantile of the NOMEM probability, Abramowitz and Stegun 26.2.23 */
+    z = 0;
+    if (nomem < 0.5) {
+        t = mbsqrt(-2 * mblog(nomem));
+        z = t - (2.515517 + 0.802853 * t + 0.010328 * t * t) /
+                (1 + 1.432788 * t + 0.189269 * t * t + 0.001308 * t * t * t);
+    }
+
+    memset(config, 0, sizeof(*config));
+    for (sp=0; sp < MB_SPACES; sp++) {
+        /* the coarsest rounding mode that packs into no more map words than no rounding */
+        best = MB_ROUND_NONE;
+        nonewords = bestwords = 0;
+        for (round = MB_ROUND_NONE; round <= MB_ROUND_POW2; round++) {
+            mbhistruns(hist, n, sp, round, runs, &mean, &var);
+            words = mbpackwords(runs);
+            if (round == MB_ROUND_NONE) {
+                nonewords = words;
+            }
+            if (words <= nonewords) {
+                best = round;
+                bestwords = words;
+            }
+        }
+
+        /* scale the packed map words up to the live nibbles at the target probability */
+        mbhistruns(hist, n, sp, best, runs, &mean, &var);
+        words = bestwords;
+        if (mean > 0) {
+            words = mbceil(words * (mean + z * mbsqrt(var)) / mean);
+        }
+        if (words > (unsigned long)MB_K_MAX * 1024 / MB_MAP_NIB_PERWORD) {
+            mbcur->err = MBERR_CONFIG;
+            return 0;
+        }
+        k = (words * MB_MAP_NIB_PERWORD + 1023) / 1024;
+        k = (k > 0) ? k : 1;
+
+        /* whole map word runs next to shorter runs need map words kept empty */
+        policy = MB_POLICY_NEXTFIT;
+        if (runs[MB_MAP_NIB_PERWORD] > 0 && mean > MB_MAP_NIB_PERWORD * runs[MB_MAP_NIB_PERWORD]) {
+            policy = MB_POLICY_FULLEST;
+        }
+
+        if (sp == MB_SMALLBLOCKS) {
+            config->k_sb_smallest = k;
+            config->sb_policy = policy;
+            config->sb_round = best;
+        } else {
+            config->k_bb_smallest = k;
+            config->bb_policy = policy;
+            config->bb_round = best;
+        }
+    }
+
+    mbcur->err = MBERR_OK;
+    return 1;
+}
+
+
+/**
+ * \brief
+ * Set the size rounding mode of a space
+ *
+ * \details
+ * Sets how mballoc() rounds the number of map nibbles of blocks of the space
+ * that allocates the given size. Blocks already allocated keep their size.
+ *
+ * \param[in]   size    block size allocated from the space
+ * \param[in]   round   MB_ROUND_NONE, MB_ROUND_EVEN or MB_ROUND_POW2
+ *
+ * \return
+ * 1 if the rounding mode is set
+ * 0 if the size or rounding mode is not valid, mberr is set
+ */
+int
+mbround_set(unsigned long size, int round)
+{
+    mbspace_t *space;
+
+    if ((space = mbspacefor(size)) == NULL) {
+        mbcur->err = MBERR_BIG;
+        return 0;
+    }
+    if (round < MB_ROUND_NONE || round > MB_ROUND_POW2) {
+        mbcur->err = MBERR_CONFIG;
+        return 0;
+    }
+    space->round = round;
+    mbcur->err = MBERR_OK;
+    return 1;
+}
+
+
+/**
+ * \brief
+ * Set the reserve of a space
+ *
+ * \details
+ * Keeps the given number of smallest blocks of the space that allocates the
+ * given size free for mballoc_prio()
+ *
+ * \param[in]   size    block size allocated from the space
+ * \param[in]   blocks  number of smallest blocks to reserve
+ *
+ * \return
+ * 1 if the reserve is set
+ * 0 if the size or number of blocks is not valid, mberr is set
+ */
+int
+mbreserve_set(unsigned long size, int blocks)
+{
+    mbspace_t *space;
+
+    if ((space = mbspacefor(size)) == NULL) {
+        mbcur->err = MBERR_BIG;
+        return 0;
+    }
+    if (blocks < 0 || blocks > space->mapwords * MB_MAP_NIB_PERWORD) {
+        mbcur->err = MBERR_CONFIG;
+        return 0;
+    }
+    space->reserve = blocks;
+    mbcur->err = MBERR_OK;
+    return 1;
+}
+
+
+/**
+ * \brief
+ * Get the reserve usage of a space
+ *
+ * \param[in]   size    block size allocated from the space
+ * \param[out]  stat    reserve usage of the space
+ *
+ * \return
+ * 1 if the usage is set
+ * 0 if the size is not valid, mberr is set
+ */
+int
+mbreserve_stat(unsigned long size, mbreserve_t *stat)
+{
+    mbspace_t *space;
+
+    if ((space = mbspacefor(size)) == NULL) {
+        mbcur->err = MBERR_BIG;
+        return 0;
+    }
+    stat->reserve = (unsigned long)space->reserve * space->bytes_pernib;
+    stat->free = (unsigned long)space->freenibs * space->bytes_pernib;
+    stat->used = (space->freenibs < space->reserve) ?
+                 (unsigned long)(space->reserve - space->freenibs) * space->bytes_pernib : 0;
+    stat->peak = (unsigned long)space->respeak * space->bytes_pernib;
+    stat->prio = space->resprio;
+    stat->denied = space->resdenied;
+    mbcur->err = MBERR_OK;
+    return 1;
+}
+
+
+/**
+ * \brief
+ * Set the fallback free function
+ *
+ * \details
+ * mbfree() passes memory that is not owned by mblib to the fallback free, so that
+ * code mixing mblib and another allocator can free through one entry point.
+ * Pass NULL to have mbfree() reject memory it does not own.
+ *
+ * \param[in]   freefn  free function for memory not owned by mblib, e.g. free()
+ */
+void
+mbsetfallback(void (*freefn)(void *))
+{
+    mbcur->fallback = freefn;
+}
+
+
+/**
+ * \brief
+ * Get the usable size of an allocated memory block
+ *
+ * \details
+ * Decodes the run length of the block from the space map. The usable size may be
+ * bigger than the size that was passed to mballoc() since allocations are rounded
+ * up to the closest block size.
+ *
+ * \param[in]   mbp     memory block pointer returned by mballoc()
+ *
+ * \return      usable bytes of the block, or 0 if the block is unknown
+ *              If 0 returned check mberr code for reason
+ */
+unsigned long
+mbsize(void *mbp)
+{
+    int         nibs;
+    uint16      mi, wi;
+    mbspace_t   *space;
+
+    space = mbspaceof(mbp);
+    if (space == NULL) {
+        mbcur->err = MBERR_UNKNOWN;
+        return 0;
+    }
+
+    mbptrloc(space, mbp, &mi, &wi);
+    nibs = mbrunnibs(space, mi, wi);
+    if (nibs == 0) {
+        mbcur->err = MBERR_MAPCORRUPT;
+        return 0;
+    }
+
+    mbcur->err = MBERR_OK;
+    return nibs * space->bytes_pernib;
+}
+
+
+/**
+ * \brief
+ * Get the block size an allocation would be rounded up to
+ *
+ * \details
+ * Returns the size of the block mballoc() would return for the given size,
+ * so that growable containers can use the whole block as their capacity.
+ *
+ * \param[in] size    number of bytes requested
+ *
+ * \return    block size in bytes, or 0 if the size is too big
+ *            If 0 returned check mberr code for reason
+ */
+unsigned long
+mbgoodsize(unsigned long size)
+{
+    int         nwords;
+    mbspace_t   *space;
+
+    space = mbspacefor(size);
+    if (space == NULL) {
+        mbcur->err = MBERR_BIG;
+        return 0;
+    }
+
+    nwords = mbrunlen(space, size);
+
+    mbcur->err = MBERR_OK;
+    return nwords * space->bytes_pernib;
+}
+
+
+/**
+ * \brief
+ * Initialize movable memory block handles
+ *
+ * \details
+ * Mallocs the handle table used by mbhalloc(). Handles are opt in, and only
+ * blocks allocated through a handle may be moved by mbcompact(). Initializing
+ * again frees the blocks of all live handles with the old table.
+ *
+ * \param[in] nhandles    maximum number of handles that can be allocated
+ *
+ * \note
+ * If the handle table cannot be allocated mberr will be set
+ */
+void
+mbhinit(int nhandles)
+{
+    unsigned int i;
+
+    for (i=0; i < mbcur->htab.used; i++) {
+        if (mbcur->htab.ent[i].ptr != NULL) {
+            mbfree(mbcur->htab.ent[i].ptr);
+        }
+    }
+    free(mbcur->htab.ent);
+    memset(&mbcur->htab, 0, sizeof(mbcur->htab));
+
+    mbcur->htab.ent = calloc(nhandles, sizeof(mbhent_t));
+    if (mbcur->htab.ent == NULL) {
+        mbcur->err = MBERR_NOMEM;
+        return;
+    }
+    mbcur->htab.size = nhandles;
+    mbcur->err = MBERR_OK;
+}
+
+
+/**
+ * \brief
+ * Get the handle table entry for a handle
+ *
+ * \details
+ * Returns the entry of an allocated handle, or NULL and sets mberr if the
+ * handle is not allocated
+ */
+static mbhent_t *
+mbhent(mbhandle_t h)
+{
+    if (h == 0 || h > mbcur->htab.used || mbcur->htab.ent[h - 1].ptr == NULL) {
+        MB_DEBUG_PRINT("Unknown handle %u\n", h);
+        mbcur->err = MBERR_UNKNOWN;
+        return NULL;
+    }
+    return &mbcur->htab.ent[h - 1];
+}
+
+
+/**
+ * \brief
+ * Allocate a movable memory block
+ *
+ * \details
+ * Allocates a block with mballoc() and returns a handle to it. The block
+ * may be moved by mbcompact() while it is not pinned, so it must only be
+ * accessed through the pointer returned by mbhpin().
+ *
+ * \param[in] size    number of bytes requested
+ *
+ * \returns   handle of the block or 0 if not available
+ *            If 0 returned check mberr code for reason
+ */
+mbhandle_t
+mbhalloc(unsigned long size)
+{
+    void        *mbp;
+    mbhandle_t  h;
+
+    if (mbcur->htab.free == 0 && mbcur->htab.used >= mbcur->htab.size) {
+        MB_DEBUG_PRINT("No handles left for %lu bytes\n", size);
+        mbcur->err = MBERR_NOMEM;
+        return 0;
+    }
+
+    mbp = mballoc(size);
+    if (mbp == NULL) {
+        return 0;
+    }
+
+    /* reuse a freed handle, or take the next unused one */
+    if (mbcur->htab.free) {
+        h = mbcur->htab.free;
+        mbcur->htab.free = mbcur->htab.ent[h - 1].next;
+    } else {
+        h = ++mbcur->htab.used;
+    }
+    mbcur->htab.ent[h - 1].ptr = mbp;
+    mbcur->htab.ent[h - 1].pins = 0;
+    return h;
+}
+
+
+/**
+ * \brief
+ * Free a movable memory block
+ *
+ * \param[in] h       handle returned by mbhalloc()
+ */
+void
+mbhfree(mbhandle_t h)
+{
+    mbhent_t *ent;
+
+    if ((ent = mbhent(h)) == NULL) {
+        return;
+    }
+    mbfree(ent->ptr);
+    ent->ptr = NULL;
+    ent->next = mbcur->htab.free;
+    mbcur->htab.free = h;
+}
+
+
+/**
+ * \brief
+ * Pin a movable memory block
+ *
+ * \details
+ * Resolves the handle to a pointer, and keeps the block from being moved until
+ * it is unpinned. Pins nest, so each mbhpin() needs a matching mbhunpin().
+ *
+ * \param[in] h       handle returned by mbhalloc()
+ *
+ * \returns   pointer to the block or NULL if the handle is not allocated
+ */
+void *
+mbhpin(mbhandle_t h)
+{
+    mbhent_t *ent;
+
+    if ((ent = mbhent(h)) == NULL) {
+        return NULL;
+    }
+    ent->pins++;
+    mbcur->err = MBERR_OK;
+    return ent->ptr;
+}
+
+
+/**
+ * \brief
+ * Unpin a movable memory block
+ *
+ * \details
+ * Pointers returned by mbhpin() must not be used after the block is unpinned.
+ *
+ * \param[in] h       handle returned by mbhalloc()
+ */
+void
+mbhunpin(mbhandle_t h)
+{
+    mbhent_t *ent;
+
+    if ((ent = mbhent(h)) == NULL) {
+        return;
+    }
+    if (ent->pins) {
+        ent->pins--;
+    }
+}
+
+
+/**
+ * \brief
+ * Compact movable memory blocks
+ *
+ * \details
+ * Moves unpinned handle blocks out of partly used map words into free runs of
+ * partly used map words at lower addresses, so that map words empty out and
+ * large free runs are restored. Compaction is incremental, each call carries
+ * on from the handle where the last call stopped. Nothing is moved while an
+ * allocation transaction is active.
+ *
+ * \param[in] budget  maximum number of handles and map words to look at
+ *
+ * \return    number of blocks moved
+ */
+int
+mbcompact(int budget)
+{
+    int         moved, nibs, dwi;
+    uint16      smi, swi, di;
+    mbword_t    smask;
+    mbhent_t    *ent;
+    mbspace_t   *space;
+    void        *dst;
+
+    /* blocks are not moved inside an allocation transaction */
+    moved = 0;
+    if (mbcur->tx.active) {
+        return 0;
+    }
+
+    while (budget-- > 0 && mbcur->htab.used) {
+        ent = &mbcur->htab.ent[mbcur->htab.cur];
+        mbcur->htab.cur = (mbcur->htab.cur + 1 < mbcur->htab.used) ? mbcur->htab.cur + 1 : 0;
+        if (ent->ptr == NULL || ent->pins) {
+            continue;
+        }
+
+        /* blocks in full map words or slab spaces are left where they are */
+        space = mbspaceof(ent->ptr);
+        mbptrloc(space, ent->ptr, &smi, &swi);
+        if (space->policy == MB_POLICY_SLAB || mbwordfit(mbmapget(space, smi), MB_MAP_RUNMASK(1)) < 0) {
+            continue;
+        }
+        nibs = mbrunnibs(space, smi, swi);
+        smask = MB_MAP_RUNMASK(nibs);
+
+        /* look for the lowest partly used map word with room */
+        dwi = -1;
+        for (di = 0; di < smi && budget > 0; di++, budget--) {
+            if (mbmapget(space, di) && (dwi = mbspacefit(space, space->bmap[di], smask)) >= 0) {
+                break;
+            }
+        }
+        if (dwi < 0) {
+            continue;
+        }
+
+        mbrunclaim(space, di, dwi, smask);
+        dst = &space->block[(di * space->bytes_perword) + (dwi * space->bytes_pernib)];
+        memcpy(dst, ent->ptr, nibs * space->bytes_pernib);
+        mbrunfree(space, smi, swi);
+        mbborrowret(space);
+        MB_DEBUG_PRINT("Moved block %p to %p\n", ent->ptr, dst);
+        ent->ptr = dst;
+        moved++;
+    }
+    return moved;
 }
 
 /**
@@ -539,14 +3601,14 @@ mbdumpmap()
     int i;
 
     printf("-------- Small Block Map --------\n");
-    for (i=0; i < mbcb.space[MB_SMALLBLOCKS].mapwords; i++) {
-        printf("%.8X ",mbcb.space[MB_SMALLBLOCKS].bmap[i]);
+    for (i=0; i < mbcur->space[MB_SMALLBLOCKS].mapwords; i++) {
+        printf("%.8X ",mbmapget(&mbcur->space[MB_SMALLBLOCKS], i));
         if (((i+1) % 8) == 0) printf("\n");
     }
 
     printf("-------- Big Block Map --------\n");
-    for (i=0; i < mbcb.space[MB_BIGBLOCKS].mapwords; i++) {
-        printf("%.8X ",mbcb.space[MB_BIGBLOCKS].bmap[i]);
+    for (i=0; i < mbcur->space[MB_BIGBLOCKS].mapwords; i++) {
+        printf("%.8X ",mbmapget(&mbcur->space[MB_BIGBLOCKS], i));
         if (((i+1) % 8) == 0) printf("\n");
     }
 }
@@ -569,12 +3631,12 @@ mbtestfree()
     int i,sp;
     mbspace_t *space;
 
-    space = &mbcb.space[MB_SMALLBLOCKS];
+    space = &mbcur->space[MB_SMALLBLOCKS];
 
     for (sp=0; sp < MB_SPACES; sp++) {
         for (i=0; i < space->mapwords; i++)
         {
-            if (space->bmap[i] != 0) {
+            if (mbmapget(space, i) != 0) {
                 if (MB_DEBUG) {
                     assert(0);
                 }
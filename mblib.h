@@ -30,20 +30,239 @@
  * closest fitting block size and take up that amount of space. The map overhead is 
  * very small, only 4 bits per smallest block size in the multiple that is allocated. 
  * This can lead to some framentation if lots of memory is allocated that in odd multiples
- * of the smallest block size (e.g. 3 or 5 or 7). If memory is not a big concern the
- * allocation could be changed not allow odd smallest block size multiples for allocation.
+ * of the smallest block size (e.g. 3 or 5 or 7). If memory is not a big concern a space
+ * can round its allocations to even multiples with MB_ROUND_EVEN, or to powers of 2
+ * with MB_ROUND_POW2, set with mbround_set() or in the instance configuration.
  *
  */
 
+#ifndef MBLIB_H
+#define MBLIB_H
+
 /** Memory Block Library Error codes */
 typedef enum { MBERR_OK = 0,
     MBERR_NOMEM,
     MBERR_BIG,
     MBERR_UNKNOWN,
     MBERR_MAPCORRUPT,
+    MBERR_TX,
+    MBERR_CONFIG,
+    MBERR_SYS,
+    MBERR_REFS,
     MBERR_LAST
 } MBERR;
 
+/** Chained buffer limits */
+#define     MB_CHAIN_SEGS               32          /* blocks per chained buffer */
+#define     MB_CHAIN_BLKSIZE            2048        /* bytes per chained buffer block */
+#define     MB_CHAIN_MAX                (MB_CHAIN_SEGS * MB_CHAIN_BLKSIZE)
+                                                    /* bytes per chained buffer */
+
+/**
+ * \brief
+ * Chained buffer segment
+ *
+ *  blk     - reference counted big block holding the segment
+ *  off     - offset of the first segment byte in the block
+ *  len     - number of bytes in the segment
+ */
+typedef struct {
+    unsigned char   *blk;
+    unsigned short  off;
+    unsigned short  len;
+} mbseg_t;
+
+/**
+ * \brief
+ * Chained buffer
+ *
+ * \details
+ * A logical byte stream of big block segments. Blocks are reference counted,
+ * so the instance must be configured with refs set.
+ *
+ *  seg     - segments of the chain in stream order
+ *  nsegs   - number of segments
+ *  len     - number of bytes in the chain
+ */
+typedef struct {
+    mbseg_t         seg[MB_CHAIN_SEGS];
+    int             nsegs;
+    unsigned long   len;
+} mbchain_t;
+
+struct iovec;
+
+/** Block channel limits */
+#define     MB_CHAN_SLOTS               512         /* maximum slots per channel ring */
+#define     MB_CHAN_LINE                64          /* cache line size */
+
+/**
+ * \brief
+ * Block channel
+ *
+ * \details
+ * A ring of block offsets that transfers block ownership from sending threads
+ * to a receiving thread. The receiver and sender indexes are kept on their own
+ * cache lines.
+ *
+ *  ring    - block offsets, allocated from the block spaces
+ *  mask    - ring index mask
+ *  base    - instance address the block offsets are from
+ *  head    - next slot to receive
+ *  reserve - next slot to reserve for sending
+ *  tail    - next slot to publish for sending
+ */
+typedef struct {
+    unsigned int    *ring;
+    unsigned int    mask;
+    unsigned char   *base;
+    unsigned int    head __attribute__((aligned(MB_CHAN_LINE)));
+    unsigned int    reserve __attribute__((aligned(MB_CHAN_LINE)));
+    unsigned int    tail;
+} mbchan_t;
+
+/**
+ * \brief
+ * Mirrored byte ring
+ *
+ * \details
+ * A byte ring for streaming records, mapped twice back to back so that any
+ * record is contiguous. One thread may produce and one thread consume.
+ *
+ *  buf     - ring memory, followed by its mirror
+ *  size    - ring size in bytes
+ *  head    - stream offset of the next byte to consume
+ *  tail    - stream offset of the next byte to commit
+ */
+typedef struct {
+    unsigned char   *buf;
+    unsigned long   size;
+    unsigned long   head;
+    unsigned long   tail;
+} mbring_t;
+
+/**
+ * \brief
+ * Memory block library instance configuration
+ *
+ *  k_sb_smallest   - k (1024) of smallest blocks for small block space,
+ *                    1 to MB_K_MAX
+ *  k_bb_smallest   - k (1024) of smallest blocks for big block space,
+ *                    1 to MB_K_MAX
+ *  refs            - 1 to keep block reference counts for mbref_alloc()
+ *  sb_policy       - placement policy for small block space, MB_POLICY_*
+ *  bb_policy       - placement policy for big block space, MB_POLICY_*
+ *  sb_round        - size rounding mode for small block space, MB_ROUND_*
+ *  bb_round        - size rounding mode for big block space, MB_ROUND_*
+ *  align           - 1 to start runs at a multiple of their length rounded up
+ *                    to a power of 2 within a map word, so free runs coalesce
+ *  borrow          - number of empty big block map words the small block space
+ *                    may borrow when it is full, 0 to never borrow
+ *  sb_reserve      - smallest blocks of small block space only mballoc_prio()
+ *                    may allocate
+ *  bb_reserve      - smallest blocks of big block space only mballoc_prio()
+ *                    may allocate
+ */
+typedef struct {
+    int             k_sb_smallest;
+    int             k_bb_smallest;
+    int             refs;
+    int             sb_policy;
+    int             bb_policy;
+    int             align;
+    int             sb_round;
+    int             bb_round;
+    int             borrow;
+    int             sb_reserve;
+    int             bb_reserve;
+} mbconfig_t;
+
+/** Largest k of smallest blocks of a space, whose map words a uint16 counts */
+#define     MB_K_MAX                    511
+
+/** Block placement policies of a space */
+#define     MB_POLICY_NEXTFIT           0           /* first fit from the last allocated map word */
+#define     MB_POLICY_FIRSTFIT          1           /* first fit from the lowest map word */
+#define     MB_POLICY_BESTFIT           2           /* map word with the tightest fitting free run */
+#define     MB_POLICY_SLAB              3           /* map words serve one run length until empty */
+#define     MB_POLICY_FULLEST           4           /* fullest map word the run fits in */
+
+/** Block size rounding modes of a space */
+#define     MB_ROUND_NONE               0           /* round to the smallest block size */
+#define     MB_ROUND_EVEN               1           /* round runs above 1 to an even number of nibbles */
+#define     MB_ROUND_POW2               2           /* round runs to 1, 2, 4 or 8 nibbles */
+
+/**
+ * \brief
+ * Allocation size histogram entry for mbautoconf()
+ *
+ *  size            - allocation size in bytes
+ *  live            - average number of live blocks of the size
+ */
+typedef struct {
+    unsigned long   size;
+    double          live;
+} mbhist_t;
+
+/**
+ * \brief
+ * Reserve usage of a space reported by mbreserve_stat()
+ *
+ *  reserve         - bytes only mballoc_prio() may allocate
+ *  free            - bytes free in the space
+ *  used            - bytes of the reserve in use
+ *  peak            - most bytes of the reserve in use at once
+ *  prio            - mballoc_prio() allocations that used the reserve
+ *  denied          - allocations refused to keep the reserve
+ */
+typedef struct {
+    unsigned long   reserve;
+    unsigned long   free;
+    unsigned long   used;
+    unsigned long   peak;
+    unsigned long   prio;
+    unsigned long   denied;
+} mbreserve_t;
+
+/** Memory block library instance */
+typedef struct mbcb_s mbctx_t;
+
+/** Movable memory block handle, 0 is not a valid handle */
+typedef unsigned int mbhandle_t;
+
+/** Block lifetime hints for mballoc_hint() */
+#define     MB_LIFETIME_SHORT           1           /* freed soon, placed from the end of a space */
+#define     MB_LIFETIME_LONG            2           /* kept, placed from the start of a space */
+
+/** Compressed memory block offset, names a block by space and map nibble index */
+typedef unsigned int mboff_t;
+
+#define     MB_OFF_NULL                 0xFFFFFFFF  /* offset of no block */
+
+/** Scoped bump arena limits */
+#define     MB_ARENA_RUNS               32          /* big block space runs per arena */
+#define     MB_ARENA_ALIGN              16          /* arena allocation alignment */
+
+/**
+ * \brief
+ * Scoped bump arena
+ *
+ * \details
+ * Arena memory is carved from big block space runs, and all of it is
+ * released at once with mbarena_release()
+ *
+ *  run     - big block space runs taken by the arena
+ *  nruns   - number of runs taken
+ *  cur     - next free byte in the current run
+ *  left    - bytes left in the current run
+ */
+typedef struct {
+    void            *run[MB_ARENA_RUNS];
+    int             nruns;
+    unsigned char   *cur;
+    unsigned long   left;
+} mbarena_t;
+
 
 /**
  * \brief
@@ -82,6 +301,70 @@ mberrstr(MBERR err);
 void
 mbinit(int k_sb_smallest, int k_bb_smallest);
 
+/**
+ * \brief
+ * Initialize memory block library with a configuration
+ *
+ * \details
+ * Same as mbinit() with the space sizes given in the configuration.
+ * The library instance initialized is the root instance, which becomes the
+ * current instance. A configuration with a space size, placement policy,
+ * rounding mode or reserve out of range initializes nothing and sets mberr to
+ * MBERR_CONFIG.
+ *
+ * \param[in] config    instance configuration
+ */
+void
+mbinit_ex(const mbconfig_t *);
+
+/**
+ * \brief
+ * Create a child instance inside a parent instance
+ *
+ * \details
+ * Claims enough consecutive empty big block map words of the parent to hold the
+ * control block, space maps and block areas of a complete child instance with
+ * the given configuration. The child is used by making it the current instance
+ * with mbuse(). It is freed back to its parent with mbdestroy(), or when the
+ * parent is reset or terminated.
+ *
+ * \param[in] parent    parent instance, or NULL for the current instance
+ * \param[in] config    child instance configuration
+ *
+ * \return    child instance or NULL if there is no room in the parent
+ *            If NULL returned check mberr code for reason
+ */
+mbctx_t *
+mbcreate_in(mbctx_t *, const mbconfig_t *);
+
+/**
+ * \brief
+ * Destroy a child instance
+ *
+ * \details
+ * Frees all the memory of a child instance back to its parent at once. If the
+ * child is the current instance its parent becomes the current instance.
+ * Children of the child are destroyed with it.
+ *
+ * \param[in] ctx       child instance returned by mbcreate_in()
+ */
+void
+mbdestroy(mbctx_t *);
+
+/**
+ * \brief
+ * Set the current instance
+ *
+ * \details
+ * All memory block library calls work on the current instance.
+ *
+ * \param[in] ctx       instance to use, or NULL for the root instance
+ *
+ * \return    previous current instance
+ */
+mbctx_t *
+mbuse(mbctx_t *);
+
 /**
  * \brief
  * Terminate memory block management
@@ -99,7 +382,10 @@ mbterm();
  * \details
  * Rounds the given size up to the closest block size in the
  * appropriate block space, and marks that space used on the
- * corresponding space map.
+ * corresponding space map. When the small block space is full and the
+ * instance is configured to borrow, small blocks are taken from empty big
+ * block map words, which go back to the big block space when they empty.
+ * Blocks of the reserve of a space are left for mballoc_prio().
  *
  * \param[in] size    number of bytes requested
  *
@@ -109,6 +395,60 @@ mbterm();
 void *
 mballoc(unsigned long);
 
+/**
+ * \brief
+ * Allocate memory block space for a priority path
+ *
+ * \details
+ * Same as mballoc() but may also allocate the reserve of the space, so that
+ * critical paths such as error reporting and shutdown keep working when the
+ * rest of the space is exhausted.
+ *
+ * \param[in] size    number of bytes requested
+ *
+ * \returns   pointer to bytes allocate or NULL if not available
+ *            If NULL returned check mberr code for reason
+ */
+void *
+mballoc_prio(unsigned long);
+
+/**
+ * \brief
+ * Allocate memory block space near a hint
+ *
+ * \details
+ * Same as mballoc() but first searches the map word of the hint block, then its
+ * neighbor map words, then the other map words of the hint's page, so that
+ * related blocks share cache lines and pages. Falls back to mballoc() if none
+ * has room or the hint is not in the space the size is allocated from.
+ *
+ * \param[in] size    number of bytes requested
+ * \param[in] hint    block to allocate near, or NULL
+ *
+ * \returns   pointer to bytes allocate or NULL if not available
+ *            If NULL returned check mberr code for reason
+ */
+void *
+mballoc_near(unsigned long, void *);
+
+/**
+ * \brief
+ * Allocate memory block space with a lifetime hint
+ *
+ * \details
+ * Same as mballoc() but places long lived blocks from the start of the space
+ * and short lived blocks from the end, so that short lived churn does not
+ * split the map words of long lived blocks.
+ *
+ * \param[in] size      number of bytes requested
+ * \param[in] lifetime  MB_LIFETIME_SHORT or MB_LIFETIME_LONG
+ *
+ * \returns   pointer to bytes allocate or NULL if not available
+ *            If NULL returned check mberr code for reason
+ */
+void *
+mballoc_hint(unsigned long, int);
+
 /**
  * \brief
  * Free memory allocated by mballoc
@@ -116,7 +456,8 @@ mballoc(unsigned long);
  * \details
  * Frees all the memory that was allocated starting from this address.
  * Do not pass in an address that was not returned from mballoc().
- * If the address given is not in the memory spaces then mberr will be set.
+ * If the address given is not in the memory spaces it is passed to the
+ * fallback free set with mbsetfallback(), or mberr will be set if there is none.
  *
  * \param[in]   mbp     memory block pointer
  *
@@ -128,52 +469,834 @@ mbfree(void *);
 
 /**
  * \brief
- * Get mblib space block allocation stats
+ * Free all memory blocks
  *
  * \details
- * Scans through space maps and writes stats into an array that is returned
- * to the caller.
+ * Invalidates all allocations by moving the spaces on to a new map generation
+ * instead of clearing the maps. Map words of an older generation are treated as
+ * empty, and are cleared the next time they are used. This takes constant time
+ * except in first and best fit spaces, whose run index is cleared in time
+ * proportional to the number of map words. All memory block pointers and
+ * handles become invalid.
+ */
+void
+mbreset(void);
+
+/**
+ * \brief
+ * Begin an allocation transaction
  *
- * \param[out] blkstat   array of allocation statistics per block
+ * \details
+ * Blocks allocated until the transaction is committed or aborted are logged,
+ * so that mbtx_abort() can free all of them in one pass over the log.
+ * Transactions do not nest. Allocation fails with MBERR_TX when the log is full.
  *
- * \return              number of statistics per space
+ * \note
+ * If a transaction is already active mberr will be set
  */
-int
-mbstatget(int *blkstat[]);
+void
+mbtx_begin(void);
 
 /**
  * \brief
- * Dump memory space block usage stats
+ * Commit an allocation transaction
  *
  * \details
- * Prints out the memory block usage statistics for the memory spaces. This is for
- * debugging.
+ * Keeps all blocks allocated in the transaction and discards the log
  */
 void
-mbdumpstat();
+mbtx_commit(void);
 
 /**
  * \brief
- * Dump memory space maps
+ * Abort an allocation transaction
  *
  * \details
- * Prints out the memory maps for the memory spaces. This is for
- * debugging.
+ * Frees all blocks allocated in the transaction by clearing their logged
+ * runs from the maps. Blocks freed in the transaction stay free. Handles of
+ * blocks allocated in the transaction point at free runs then, so they are
+ * freed as well.
+ */
+void
+mbtx_abort(void);
 
+/**
+ * \brief
+ * Free a batch of memory blocks
+ *
+ * \details
+ * Frees each of the n memory blocks in the array as mbfree() does.
+ * NULL entries are skipped.
+ *
+ * \param[in]   mbp     array of memory block pointers
+ * \param[in]   n       number of memory block pointers in the array
  */
 void
-mbdumpmap();
+mbfree_n(void **, int);
 
 /**
  * \brief
- * Test that all memory blocks are free
+ * Allocate memory block space as a compressed offset
  *
  * \details
- * Tests that both memory spaces are unused. This is for testing purposes.
+ * Same as mballoc() but returns a 32 bit offset naming the block instead of a
+ * pointer, for pointer dense data structures. Convert it with mboff2ptr().
+ *
+ * \param[in] size    number of bytes requested
+ *
+ * \returns   offset of the block or MB_OFF_NULL if not available
+ *            If MB_OFF_NULL returned check mberr code for reason
+ */
+mboff_t
+mballoc_off(unsigned long);
+
+/**
+ * \brief
+ * Free a memory block by its compressed offset
+ *
+ * \param[in]   off     offset returned by mballoc_off() or mbptr2off()
+ */
+void
+mbfree_off(mboff_t);
+
+/**
+ * \brief
+ * Initialize a scoped bump arena
+ *
+ * \param[out]  arena   arena to initialize
+ */
+void
+mbarena_init(mbarena_t *);
+
+/**
+ * \brief
+ * Allocate memory from a scoped bump arena
+ *
+ * \details
+ * Carves the memory from the current arena run by bumping a pointer, with no
+ * map update per allocation. When the run has no room a new big block space run
+ * is taken, a full map word (2048 bytes) if one is free, or else a run just big
+ * enough for the allocation.
+ * Allocations are rounded up to 16 bytes, and 0 bytes to 16 bytes.
+ *
+ * \param[in]   arena   arena to allocate from
+ * \param[in]   size    number of bytes requested
+ *
+ * \returns     pointer to bytes allocated or NULL if not available
+ *              If NULL returned check mberr code for reason
+ */
+void *
+mbarena_alloc(mbarena_t *, unsigned long);
+
+/**
+ * \brief
+ * Release all memory of a scoped bump arena
+ *
+ * \details
+ * Frees all the arena runs at once with mbfree_n(). The arena may be used
+ * again afterwards.
+ *
+ * \param[in]   arena   arena to release
+ */
+void
+mbarena_release(mbarena_t *);
+
+/**
+ * \brief
+ * Allocate a reference counted memory block
+ *
+ * \details
+ * Allocates a block with mballoc() with a reference count of 1. The count is
+ * kept in a side array indexed by map nibble, so the block has no header.
+ * The instance must be configured with refs set.
+ *
+ * \param[in] size    number of bytes requested
+ *
+ * \returns   pointer to bytes allocate or NULL if not available
+ *            If NULL returned check mberr code for reason
+ */
+void *
+mbref_alloc(unsigned long);
+
+/**
+ * \brief
+ * Take a reference to a reference counted memory block
+ *
+ * \details
+ * The reference count is updated atomically, so references may be taken and
+ * put from any thread. A block has at most 65535 references, and taking one
+ * more fails rather than wrap the count.
+ *
+ * \param[in]   mbp     memory block pointer returned by mbref_alloc()
  *
  * \return
- * TRUE    if all memory block space is free
- * FALSE  if some memory block space is allocated
+ * 1 if the reference is taken
+ * 0 if the block is not reference counted or has 65535 references, mberr is set
  */
 int
-mbtestfree();
+mbref_get(void *);
+
+/**
+ * \brief
+ * Put a reference to a reference counted memory block
+ *
+ * \details
+ * Frees the block when the last reference is put. The reference count is
+ * updated atomically, but freeing the block updates the space map, so calls
+ * that allocate and free must still not run at the same time.
+ *
+ * \param[in]   mbp     memory block pointer returned by mbref_alloc()
+ */
+void
+mbref_put(void *);
+
+/**
+ * \brief
+ * Get the number of references to a reference counted memory block
+ *
+ * \param[in]   mbp     memory block pointer returned by mbref_alloc()
+ *
+ * \return      number of references, or 0 if the block is unknown
+ */
+int
+mbref_count(void *);
+
+/**
+ * \brief
+ * Initialize a chained buffer
+ *
+ * \param[out]  chain   chained buffer to initialize
+ */
+void
+mbchain_init(mbchain_t *);
+
+/**
+ * \brief
+ * Append bytes to a chained buffer
+ *
+ * \details
+ * Copies the bytes into the free room of the last block of the chain, and into
+ * new big blocks linked to the chain as needed. A chain has at most
+ * MB_CHAIN_SEGS blocks, so it holds at most MB_CHAIN_MAX (64 KiB) bytes. A
+ * payload that does not fit the room left is not appended, and mberr is set
+ * to MBERR_BIG.
+ *
+ * \param[in]   chain   chained buffer
+ * \param[in]   data    bytes to append
+ * \param[in]   len     number of bytes to append
+ *
+ * \return      number of bytes appended
+ *              If less than len check mberr code for reason
+ */
+unsigned long
+mbchain_append(mbchain_t *, const void *, unsigned long);
+
+/**
+ * \brief
+ * Consume bytes from the front of a chained buffer
+ *
+ * \details
+ * Drops the bytes without copying them, and puts the blocks that are emptied.
+ *
+ * \param[in]   chain   chained buffer
+ * \param[in]   len     number of bytes to consume
+ *
+ * \return      number of bytes consumed
+ */
+unsigned long
+mbchain_consume(mbchain_t *, unsigned long);
+
+/**
+ * \brief
+ * Slice a chained buffer
+ *
+ * \details
+ * Makes a new chain of len bytes starting at offset off of the source chain.
+ * The new chain references the same blocks, so no bytes are copied. Blocks shared
+ * by chains are not appended to.
+ *
+ * \param[in]   src     source chained buffer
+ * \param[in]   off     offset of the first byte of the slice
+ * \param[in]   len     number of bytes in the slice
+ * \param[out]  dst     chained buffer for the slice, initialized by this call
+ *
+ * \return      number of bytes in the slice
+ *              If less than len check mberr code for reason
+ */
+unsigned long
+mbchain_slice(const mbchain_t *, unsigned long, unsigned long, mbchain_t *);
+
+/**
+ * \brief
+ * Export a chained buffer as an iovec array
+ *
+ * \details
+ * Fills the iovec array with the bytes of the chain, for writev() or sendmsg().
+ *
+ * \param[in]   chain   chained buffer
+ * \param[out]  iov     iovec array
+ * \param[in]   max     number of entries in the iovec array
+ *
+ * \return      number of iovec entries filled
+ */
+int
+mbchain_iov(const mbchain_t *, struct iovec *, int);
+
+/**
+ * \brief
+ * Prepare a chained buffer to receive bytes
+ *
+ * \details
+ * Fills the iovec array with up to len bytes of free room at the end of the
+ * chain, linking new big blocks to the chain as needed, for readv() or recvmsg().
+ * The bytes received are added to the chain with mbchain_commit(). A payload
+ * that does not fit the room left of at most MB_CHAIN_MAX (64 KiB) bytes per
+ * chain fills no entries, and mberr is set to MBERR_BIG.
+ *
+ * \param[in]   chain   chained buffer
+ * \param[in]   len     number of bytes to receive
+ * \param[out]  iov     iovec array
+ * \param[in]   max     number of entries in the iovec array
+ *
+ * \return      number of iovec entries filled
+ */
+int
+mbchain_recv_iov(mbchain_t *, unsigned long, struct iovec *, int);
+
+/**
+ * \brief
+ * Add received bytes to a chained buffer
+ *
+ * \details
+ * Adds len bytes received into the iovec array filled by mbchain_recv_iov()
+ * to the chain.
+ *
+ * \param[in]   chain   chained buffer
+ * \param[in]   len     number of bytes received
+ */
+void
+mbchain_commit(mbchain_t *, unsigned long);
+
+/**
+ * \brief
+ * Free a chained buffer
+ *
+ * \details
+ * Puts all blocks of the chain. The chain may be used again afterwards.
+ *
+ * \param[in]   chain   chained buffer
+ */
+void
+mbchain_free(mbchain_t *);
+
+#ifdef __linux__
+/**
+ * \brief
+ * Register the block spaces with an io_uring instance
+ *
+ * \details
+ * Registers the block area of each space as an io_uring fixed buffer, with the
+ * space number as buffer index, so that reads and writes to blocks can use
+ * IORING_OP_READ_FIXED and IORING_OP_WRITE_FIXED with no page pinning per I/O.
+ * mburing_buf() gives the buffer index of a block.
+ *
+ * \param[in]   ringfd  io_uring file descriptor
+ *
+ * \return
+ * 1 if the block spaces are registered
+ * 0 if registration failed, mberr is set and errno has the reason
+ */
+int
+mburing_register(int);
+
+/**
+ * \brief
+ * Unregister the block spaces from an io_uring instance
+ *
+ * \param[in]   ringfd  io_uring file descriptor
+ *
+ * \return
+ * 1 if the block spaces are unregistered
+ * 0 if unregistration failed, mberr is set and errno has the reason
+ */
+int
+mburing_unregister(int);
+
+/**
+ * \brief
+ * Get the io_uring fixed buffer of a memory block
+ *
+ * \details
+ * Translates a memory block pointer to the fixed buffer index and offset
+ * registered by mburing_register(). Fixed buffer reads and writes take the
+ * block address itself along with the buffer index.
+ *
+ * \param[in]   mbp     memory block pointer
+ * \param[out]  bufidx  fixed buffer index
+ * \param[out]  off     offset of the block in the fixed buffer
+ *
+ * \return
+ * 1 if the memory is in a registered block space
+ * 0 if it is not
+ */
+int
+mburing_buf(void *, unsigned int *, unsigned long *);
+
+/**
+ * \brief
+ * Initialize a mirrored byte ring
+ *
+ * \details
+ * Maps the ring memory twice back to back from a memfd, so that a record that
+ * runs past the end of the ring continues in the mirror and is always
+ * contiguous in virtual memory.
+ *
+ * \param[out]  ring    byte ring to initialize
+ * \param[in]   size    ring size in bytes, rounded up to a multiple of the page size
+ *
+ * \return
+ * 1 if the ring is initialized
+ * 0 if the ring could not be mapped, mberr is set and errno has the reason
+ */
+int
+mbring_init(mbring_t *, unsigned long);
+
+/**
+ * \brief
+ * Terminate a mirrored byte ring
+ *
+ * \param[in]   ring    byte ring to terminate
+ */
+void
+mbring_term(mbring_t *);
+
+/**
+ * \brief
+ * Reserve room for a record in a mirrored byte ring
+ *
+ * \details
+ * Returns contiguous room for a record of len bytes at the end of the ring.
+ * The record is added to the ring with mbring_commit().
+ *
+ * \param[in]   ring    byte ring
+ * \param[in]   len     number of bytes to reserve
+ *
+ * \return      pointer to the reserved room or NULL if the ring has no room
+ */
+void *
+mbring_reserve(mbring_t *, unsigned long);
+
+/**
+ * \brief
+ * Commit a record to a mirrored byte ring
+ *
+ * \param[in]   ring    byte ring
+ * \param[in]   len     number of bytes written in the room from mbring_reserve()
+ */
+void
+mbring_commit(mbring_t *, unsigned long);
+
+/**
+ * \brief
+ * Get the committed bytes of a mirrored byte ring
+ *
+ * \param[in]   ring    byte ring
+ * \param[out]  len     number of committed bytes
+ *
+ * \return      pointer to the committed bytes, which are contiguous
+ */
+void *
+mbring_peek(mbring_t *, unsigned long *);
+
+/**
+ * \brief
+ * Consume bytes from a mirrored byte ring
+ *
+ * \param[in]   ring    byte ring
+ * \param[in]   len     number of committed bytes to consume
+ */
+void
+mbring_consume(mbring_t *, unsigned long);
+#endif /* __linux__ */
+
+/**
+ * \brief
+ * Initialize a block channel
+ *
+ * \details
+ * Allocates the channel ring from the block spaces. The ring holds 32-bit
+ * block offsets from the start of the current instance, so the channel is only
+ * used with blocks of that instance.
+ *
+ * \param[out]  chan    channel to initialize
+ * \param[in]   slots   number of ring slots, rounded up to a power of 2
+ *                      and at most MB_CHAN_SLOTS
+ *
+ * \return
+ * 1 if the channel is initialized
+ * 0 if the ring could not be allocated, mberr is set
+ */
+int
+mbchan_init(mbchan_t *, int);
+
+/**
+ * \brief
+ * Terminate a block channel
+ *
+ * \details
+ * Frees the channel ring. Blocks still in the channel are not freed.
+ *
+ * \param[in]   chan    channel to terminate
+ */
+void
+mbchan_term(mbchan_t *);
+
+/**
+ * \brief
+ * Send blocks on a block channel
+ *
+ * \details
+ * Transfers ownership of a batch of blocks to the receiver. Any number of
+ * threads may send on a channel. The slots of the batch are reserved first,
+ * and the batch is published in reservation order with one store.
+ *
+ * \param[in]   chan    channel to send on
+ * \param[in]   mbp     array of memory block pointers to send
+ * \param[in]   n       number of memory block pointers in the array
+ *
+ * \return      number of blocks sent, less than n if the ring is full
+ */
+int
+mbchan_send(mbchan_t *, void **, int);
+
+/**
+ * \brief
+ * Receive blocks from a block channel
+ *
+ * \details
+ * Takes ownership of a batch of blocks sent on the channel. Only one thread may
+ * receive from a channel. Received blocks can be freed together with mbfree_n().
+ *
+ * \param[in]   chan    channel to receive from
+ * \param[out]  mbp     array for the received memory block pointers
+ * \param[in]   max     number of entries in the array
+ *
+ * \return      number of blocks received
+ */
+int
+mbchan_recv(mbchan_t *, void **, int);
+
+/**
+ * \brief
+ * Test if memory is owned by mblib
+ *
+ * \details
+ * Checks if the given address is in the block area of one of the memory spaces.
+ * This is an exact range check, so any pointer from another allocator is reported
+ * as not owned.
+ *
+ * \param[in]   mbp     memory pointer
+ *
+ * \return
+ * 1 if the memory is in an mblib block space
+ * 0 if it is not
+ */
+int
+mbowns(void *);
+
+/**
+ * \brief
+ * Set the placement policy of a space
+ *
+ * \details
+ * Sets how mballoc() picks the map word for blocks of the space that allocates
+ * the given size. Next fit continues from the last allocated map word. First fit
+ * takes the lowest map word with room, keeping the space compact. Best fit takes
+ * the map word whose longest free run is the tightest fit, keeping long runs
+ * whole. First and best fit look up map words in a longest free run index.
+ * Slab gives each map word a run length when it is first used, and it only
+ * serves that length until it empties, with lists of partly used map words per
+ * length, so that allocation and free take constant time. Fullest keeps map
+ * words in buckets by free nibble count and takes the fullest map word the run
+ * fits in, so that other map words stay empty for long runs. Slab and fullest
+ * need an instance configured with MB_POLICY_SLAB or MB_POLICY_FULLEST for one
+ * of its spaces.
+ *
+ * \param[in]   size    block size allocated from the space
+ * \param[in]   policy  MB_POLICY_NEXTFIT, MB_POLICY_FIRSTFIT, MB_POLICY_BESTFIT,
+ *                      MB_POLICY_SLAB or MB_POLICY_FULLEST
+ *
+ * \return
+ * 1 if the policy is set
+ * 0 if the size or policy is not valid, mberr is set
+ */
+int
+mbpolicy_set(unsigned long, int);
+
+/**
+ * \brief
+ * Set the size rounding mode of a space
+ *
+ * \details
+ * Sets how mballoc() rounds blocks of the space that allocates the given size.
+ * Even rounding allocates runs of 1, 2, 4, 6 or 8 map nibbles, and power of 2
+ * rounding runs of 1, 2, 4 or 8, trading internal waste for free runs that fit
+ * more sizes. mbgoodsize() reports the rounded size.
+ *
+ * \param[in]   size    block size allocated from the space
+ * \param[in]   round   MB_ROUND_NONE, MB_ROUND_EVEN or MB_ROUND_POW2
+ *
+ * \return
+ * 1 if the rounding mode is set
+ * 0 if the size or rounding mode is not valid, mberr is set
+ */
+int
+mbround_set(unsigned long, int);
+
+/**
+ * \brief
+ * Set the reserve of a space
+ *
+ * \details
+ * Keeps the given number of smallest blocks of the space that allocates the
+ * given size free for mballoc_prio(). Other allocations fail with
+ * MBERR_NOMEM rather than use them.
+ *
+ * \param[in]   size    block size allocated from the space
+ * \param[in]   blocks  number of smallest blocks to reserve
+ *
+ * \return
+ * 1 if the reserve is set
+ * 0 if the size or number of blocks is not valid, mberr is set
+ */
+int
+mbreserve_set(unsigned long, int);
+
+/**
+ * \brief
+ * Get the reserve usage of a space
+ *
+ * \param[in]   size    block size allocated from the space
+ * \param[out]  stat    reserve usage of the space
+ *
+ * \return
+ * 1 if the usage is set
+ * 0 if the size is not valid, mberr is set
+ */
+int
+mbreserve_stat(unsigned long, mbreserve_t *);
+
+/**
+ * \brief
+ * Recommend an instance configuration for a workload
+ *
+ * \details
+ * Packs the runs of the average live blocks of each size into map words, largest
+ * first, with each rounding mode, and keeps the coarsest mode that needs no more
+ * map words than no rounding. The live block counts are taken as Poisson, and
+ * each space is sized so that its live runs exceed it with at most the given
+ * probability. A space that holds whole map word runs next to shorter ones uses
+ * the fullest policy, which keeps map words empty for them. The configuration
+ * can be passed straight to mbinit_ex() or mbcreate_in().
+ *
+ * \param[in]   hist    size histogram
+ * \param[in]   n       number of histogram entries
+ * \param[in]   nomem   target probability of MBERR_NOMEM, 0 to 0.5
+ * \param[out]  config  recommended configuration
+ *
+ * \return
+ * 1 if the configuration is set
+ * 0 if a size is too big, a space would need more than MB_K_MAX k of
+ *   smallest blocks or the arguments are not valid, mberr is set
+ */
+int
+mbautoconf(const mbhist_t *, int, double, mbconfig_t *);
+
+/**
+ * \brief
+ * Set the fallback free function
+ *
+ * \details
+ * mbfree() passes memory that is not owned by mblib to the fallback free, so that
+ * code mixing mblib and another allocator can free through one entry point.
+ * Pass NULL to have mbfree() reject memory it does not own.
+ *
+ * \param[in]   freefn  free function for memory not owned by mblib, e.g. free()
+ */
+void
+mbsetfallback(void (*freefn)(void *));
+
+/**
+ * \brief
+ * Get the usable size of an allocated memory block
+ *
+ * \details
+ * Decodes the run length of the block from the space map. The usable size may be
+ * bigger than the size that was passed to mballoc() since allocations are rounded
+ * up to the closest block size.
+ *
+ * \param[in]   mbp     memory block pointer returned by mballoc()
+ *
+ * \return      usable bytes of the block, or 0 if the block is unknown
+ *              If 0 returned check mberr code for reason
+ */
+unsigned long
+mbsize(void *);
+
+/**
+ * \brief
+ * Get the block size an allocation would be rounded up to
+ *
+ * \details
+ * Returns the size of the block mballoc() would return for the given size,
+ * including the rounding mode of its space, so that growable containers can
+ * use the whole block as their capacity.
+ *
+ * \param[in] size    number of bytes requested
+ *
+ * \return    block size in bytes, or 0 if the size is too big
+ *            If 0 returned check mberr code for reason
+ */
+unsigned long
+mbgoodsize(unsigned long);
+
+/**
+ * \brief
+ * Initialize movable memory block handles
+ *
+ * \details
+ * Mallocs the handle table used by mbhalloc(). Handles are opt in, and only
+ * blocks allocated through a handle may be moved by mbcompact(). Initializing
+ * again frees the blocks of all live handles with the old table.
+ *
+ * \param[in] nhandles    maximum number of handles that can be allocated
+ *
+ * \note
+ * If the handle table cannot be allocated mberr will be set
+ */
+void
+mbhinit(int nhandles);
+
+/**
+ * \brief
+ * Allocate a movable memory block
+ *
+ * \details
+ * Allocates a block with mballoc() and returns a handle to it. The block
+ * may be moved by mbcompact() while it is not pinned, so it must only be
+ * accessed through the pointer returned by mbhpin().
+ *
+ * \param[in] size    number of bytes requested
+ *
+ * \returns   handle of the block or 0 if not available
+ *            If 0 returned check mberr code for reason
+ */
+mbhandle_t
+mbhalloc(unsigned long);
+
+/**
+ * \brief
+ * Free a movable memory block
+ *
+ * \param[in] h       handle returned by mbhalloc()
+ */
+void
+mbhfree(mbhandle_t);
+
+/**
+ * \brief
+ * Pin a movable memory block
+ *
+ * \details
+ * Resolves the handle to a pointer, and keeps the block from being moved until
+ * it is unpinned. Pins nest, so each mbhpin() needs a matching mbhunpin().
+ *
+ * \param[in] h       handle returned by mbhalloc()
+ *
+ * \returns   pointer to the block or NULL if the handle is not allocated
+ */
+void *
+mbhpin(mbhandle_t);
+
+/**
+ * \brief
+ * Unpin a movable memory block
+ *
+ * \details
+ * Pointers returned by mbhpin() must not be used after the block is unpinned.
+ *
+ * \param[in] h       handle returned by mbhalloc()
+ */
+void
+mbhunpin(mbhandle_t);
+
+/**
+ * \brief
+ * Compact movable memory blocks
+ *
+ * \details
+ * Moves unpinned handle blocks out of partly used map words into free runs of
+ * partly used map words at lower addresses, so that map words empty out and
+ * large free runs are restored. Compaction is incremental, each call carries
+ * on from the handle where the last call stopped.
+ *
+ * \param[in] budget  maximum number of handles and map words to look at
+ *
+ * \return    number of blocks moved
+ */
+int
+mbcompact(int budget);
+
+/**
+ * \brief
+ * Get mblib space block allocation stats
+ *
+ * \details
+ * Scans through space maps and writes stats into an array that is returned
+ * to the caller.
+ *
+ * \param[out] blkstat   array of allocation statistics per block
+ *
+ * \return              number of statistics per space
+ */
+int
+mbstatget(int *blkstat[]);
+
+/**
+ * \brief
+ * Dump memory space block usage stats
+ *
+ * \details
+ * Prints out the memory block usage statistics for the memory spaces. This is for
+ * debugging.
+ */
+void
+mbdumpstat();
+
+/**
+ * \brief
+ * Dump memory space maps
+ *
+ * \details
+ * Prints out the memory maps for the memory spaces. This is for
+ * debugging.
+
+ */
+void
+mbdumpmap();
+
+/**
+ * \brief
+ * Test that all memory blocks are free
+ *
+ * \details
+ * Tests that both memory spaces are unused. This is for testing purposes.
+ *
+ * \return
+ * TRUE    if all memory block space is free
+ * FALSE  if some memory block space is allocated
+ */
+int
+mbtestfree();
+
+#endif /* MBLIB_H */
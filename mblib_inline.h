@@ -0,0 +1,440 @@
+/**
+ * \brief
+ * Memory Block Allocation inline fast path
+ *
+ * \details
+ * Exposes the block space layout so that allocations can be done without a
+ * library call. mballoc_fast() selects the block space and map run at compile
+ * time when the size is a constant, and tries to claim the run in the current
+ * map word of the space. If the current map word has no room, or the size does
+ * not fit a block space, it falls back to mballoc().
+ *
+ * Blocks allocated with mballoc_fast() are freed with mbfree().
+ *
+ * Include this header after mblib.h in code that allocates in hot loops. Only
+ * what mballoc_fast(), mboff2ptr() and mbptr2off() read is declared here, the
+ * rest of the library internals are in mblib_int.h.
+ *
+ */
+
+#ifndef MBLIB_INLINE_H
+#define MBLIB_INLINE_H
+
+#include <stddef.h>
+
+#include "mblib.h"
+
+/** Memblock base types */
+typedef unsigned char   mb_byte_t;
+typedef unsigned short  mb_uint16;
+
+/** \brief Unit used for memory map allocation */
+typedef unsigned int    mb_word_t;
+
+/** Map and space constants */
+#define     MB_MAP_NIB_PERWORD          ((int)(sizeof(mb_word_t) << 1))
+#define     MB_MAP_BITS_PERNIB          4
+
+#define     MB_SMALLBLOCKS              0
+#define     MB_BIGBLOCKS                1
+#define     MB_SPACES                   2
+
+#define     MB_SBMAP_BYTES_PERNIB       16
+#define     MB_SBMAP_BYTES_PERWORD      (MB_SBMAP_BYTES_PERNIB * MB_MAP_NIB_PERWORD)
+
+#define     MB_BBMAP_BYTES_PERNIB       (MB_SBMAP_BYTES_PERWORD << 1)
+#define     MB_BBMAP_BYTES_PERWORD      (MB_BBMAP_BYTES_PERNIB * MB_MAP_NIB_PERWORD)
+
+#define     MB_MAP_ALLOC_RTN_MAP        0x0000000F          /* right nost nibble */
+
+#define     MB_OFF_SPACE_SHIFT          31          /* compressed offset space bit */
+#define     MB_OFF_NIB_MASK             0x7FFFFFFF  /* compressed offset nibble index */
+
+/** \brief Map mask for all nibbles of a run of n (1 to 8) nibbles */
+#define     MB_MAP_NIBMASK(n)           ((n) < MB_MAP_NIB_PERWORD ?                             \
+                                         ~(0xFFFFFFFF >> ((n) * MB_MAP_BITS_PERNIB)) :          \
+                                         0xFFFFFFFF)
+
+/** \brief Map mask for an allocated run of n (1 to 8) nibbles */
+#define     MB_MAP_RUNMASK(n)           (MB_MAP_NIBMASK(n) -                                    \
+                                         (0xEU << ((MB_MAP_NIB_PERWORD - (n)) * MB_MAP_BITS_PERNIB)))
+
+
+/**
+ * \brief
+ * Memory block map and block space
+ *
+ * \details
+ * Each Memory block space is mapped with a nibble map of words
+ *
+ * Each 4 bits in the small block map represents 4 words of small block memory (16 bytes)
+ * Each word in the small block map tracks 32 words of small block memory (128 bytes)
+ *
+ * Each 4 bits in the large block map represents 64 words of big block memory (256 bytes)
+ * Each word in the big block map tracks 256 words (2k)
+ *
+ * The small block area allocates sizes from 16 to 128 bytes, rounding up to the closest 16 bytes (4 words)
+ *
+ * The big block area allocates sizes from 256 bytes to 2k, rounding up to the closest 256 bytes (64 words)
+ *
+ * Free memory is marked with 0 (4 bits for 4 words)
+ *   A single allocated block (4 words) is marked allocated with a 1
+ *
+ *   More than 4 allocated words are marked allocated beginning 
+ *   with an F and ending with a 1, with F's marked between
+ *
+ * Memory allocation is only done within map words, and not across them. This can
+ * lead to some framentation if odd numbers of the minimum block size for a space
+ * are allocated, unless the space rounds them with MB_ROUND_EVEN or MB_ROUND_POW2.
+ * Any number of block sizes for a space may be allocated from any 
+ * map word
+ *
+ *  bytes_pernib    - bytes reserved per map nibble (4 bits)
+ *  bytes_perword   - bytes reserved per map word
+ *  mapwords        - number of map words for this space
+ *  mi              - current index into map
+ *  mifit           - longest free run left in map word mi, runs that are longer
+ *                    are searched from the next map word
+ *  lmi             - long lived allocation index, ascending from the first map word
+ *  smi             - short lived allocation index, descending from the last map word
+ *  curgen          - current map generation
+ *  bmap            - block map
+ *  block           - memory for blocks
+ *  gen             - map generation of each map word, words of an older
+ *                    generation are empty
+ *  refcnt          - reference count of each map nibble, NULL if not kept
+ *  round           - size rounding mode, MB_ROUND_NONE, EVEN or POW2
+ *  align           - 1 if runs start at a multiple of their length rounded up
+ *                    to a power of 2 within the map word
+ *  policy          - placement policy, MB_POLICY_NEXTFIT, FIRSTFIT, BESTFIT, SLAB
+ *                    or FULLEST
+ *  runidx          - longest free run index, a bitmap of map words for each
+ *                    run length of 1 to 8 nibbles, kept for first and best fit
+ *  hwm             - slab high water map word, map words from it up are empty
+ *                    and on no slab list
+ *  slabhead        - first map word of the slab empty list, then of the partial
+ *                    list of each run length of 1 to 8 nibbles, or with the
+ *                    fullest policy of the bucket of each free nibble count
+ *  slabnext        - next map word on the slab list of each map word
+ *  slabprev        - previous map word on the slab list of each map word
+ *  slabcls         - slab run length of each map word, with MB_SLAB_* flags, or
+ *                    its bucket with the fullest policy, NULL if lists are not kept
+ *  freenibs        - number of free map nibbles
+ *  reserve         - free map nibbles only mballoc_prio() may allocate
+ *  respeak         - most reserve nibbles in use at once
+ *  resprio         - mballoc_prio() allocations that used the reserve
+ *  resdenied       - allocations refused to keep the reserve
+ *  scanned         - map words next fit searched, for benchmarks
+ */
+typedef struct {
+    const mb_uint16     bytes_pernib;
+    const mb_uint16     bytes_perword;
+    mb_uint16           mapwords;
+    mb_uint16           mi;
+    mb_uint16           mifit;
+    mb_uint16           lmi;
+    mb_uint16           smi;
+    mb_uint16           curgen;
+    mb_word_t          *bmap;
+    mb_byte_t          *block;
+    mb_uint16          *gen;
+    mb_uint16          *refcnt;
+    int                 round;
+    int                 align;
+    int                 policy;
+    mb_word_t          *runidx;
+    mb_uint16           hwm;
+    mb_uint16           slabhead[MB_MAP_NIB_PERWORD + 1];
+    mb_uint16          *slabnext;
+    mb_uint16          *slabprev;
+    mb_byte_t          *slabcls;
+    unsigned int        freenibs;
+    unsigned int        reserve;
+    unsigned int        respeak;
+    unsigned long       resprio;
+    unsigned long       resdenied;
+    unsigned long       scanned;
+} mbspace_t;
+
+/** \brief
+  * Leading members of a memory block library control block
+  * \details
+  * The control block of each instance starts with these members, and
+  * mballoc_fast() reads the current instance through them
+  *
+  * err      - Last recorded error
+  * space    - Array of memory spaces
+  * txactive - Set while an allocation transaction is active
+  */
+typedef struct {
+    MBERR           err;
+    mbspace_t       space[MB_SPACES];
+    int             txactive;
+} mbfast_t;
+
+/** \brief Current memory block libary instance, seen through its leading members */
+extern mbfast_t *mb_cur;
+
+
+/**
+ * \brief
+ * Round a run length
+ *
+ * \details
+ * Rounds a run of n (1 to 8) nibbles up to an even number of nibbles or to a
+ * power of 2 for the rounding mode. Runs of 1 nibble are not rounded.
+ */
+static inline int
+mbrunround(int n, int round)
+{
+    if (round == MB_ROUND_EVEN) {
+        return (n == 1) ? 1 : (n + 1) & ~1;
+    }
+    if (round == MB_ROUND_POW2) {
+        return (n > 4) ? 8 : (n > 2) ? 4 : n;
+    }
+    return n;
+}
+
+
+/**
+ * \brief
+ * Get a map word
+ *
+ * \details
+ * Returns the value of map word mi of the space. A map word of an older
+ * generation is cleared first, since mbreset() freed all of its blocks.
+ */
+static inline mb_word_t
+mbmapget(mbspace_t *space, mb_uint16 mi)
+{
+    if (space->gen[mi] != space->curgen) {
+        space->gen[mi] = space->curgen;
+        space->bmap[mi] = 0;
+    }
+    return space->bmap[mi];
+}
+
+
+/**
+ * \brief
+ * Find a free run in a map word
+ *
+ * \details
+ * Scans the map word left to right with the allocation mask of a run that
+ * starts at nibble 0. Returns the nibble index where the run fits, or -1 if
+ * it does not fit in the map word.
+ */
+static inline int
+mbwordfit(mb_word_t mword, mb_word_t smask)
+{
+    int wi;
+
+    for (wi = 0; mword & smask; wi++) {
+        if (smask & MB_MAP_ALLOC_RTN_MAP) {
+            return -1;
+        }
+        smask >>= MB_MAP_BITS_PERNIB;
+    }
+    return wi;
+}
+
+
+/**
+ * \brief
+ * Get the longest free run of a map word
+ *
+ * \details
+ * Returns the number of nibbles in the longest run of free nibbles, 0 to 8
+ */
+static inline int
+mbfreerun(mb_word_t mword)
+{
+    int         longest;
+    mb_word_t   free;
+
+    /* one bit per free nibble, then shorten every run of bits by one until none are left */
+    free = ~(mword | (mword >> 1) | (mword >> 2) | (mword >> 3)) & 0x11111111;
+    for (longest = 0; free; longest++) {
+        free &= free << MB_MAP_BITS_PERNIB;
+    }
+    return longest;
+}
+
+
+/**
+ * \brief
+ * Find an aligned free run in a map word
+ *
+ * \details
+ * Same as mbwordfit() but only tries runs that start at a multiple of the run
+ * length rounded up to a power of 2, so a run of 2 starts at nibble 0, 2, 4 or 6,
+ * and a run of 3 or 4 at nibble 0 or 4.
+ */
+static inline int
+mbalignfit(mb_word_t mword, mb_word_t smask)
+{
+    int wi, step;
+
+    /* the end nibble of the start mask gives the run length */
+    for (step = 1; step < MB_MAP_NIB_PERWORD - (__builtin_ctz(smask) / MB_MAP_BITS_PERNIB); step <<= 1)
+        ;
+    for (wi = 0; wi < MB_MAP_NIB_PERWORD; wi += step) {
+        if (!(mword & (smask >> (wi * MB_MAP_BITS_PERNIB)))) {
+            return wi;
+        }
+    }
+    return -1;
+}
+
+
+/**
+ * \brief
+ * Find a free run in a map word of a space
+ *
+ * \details
+ * Uses aligned runs if the space aligns them
+ */
+static inline int
+mbspacefit(const mbspace_t *space, mb_word_t mword, mb_word_t smask)
+{
+    return space->align ? mbalignfit(mword, smask) : mbwordfit(mword, smask);
+}
+
+
+/**
+ * \brief
+ * Get the longest run that fits in a map word of a space
+ *
+ * \details
+ * Returns the longest free run, or if the space aligns runs the longest run
+ * that fits at an aligned nibble, 0 to 8
+ */
+static inline int
+mbspacerun(const mbspace_t *space, mb_word_t mword)
+{
+    int run;
+
+    if (!space->align) {
+        return mbfreerun(mword);
+    }
+    for (run = MB_MAP_NIB_PERWORD; run > 0 && mbalignfit(mword, MB_MAP_RUNMASK(run)) < 0; run--)
+        ;
+    return run;
+}
+
+
+/**
+ * \brief
+ * Allocate memory block space inline
+ *
+ * \details
+ * Same as mballoc() but tries to claim the block in the current map word of
+ * the space without a library call. Falls back to mballoc() if the current
+ * map word has no room, the size does not fit a block space, an allocation
+ * transaction is active, or the space does not use the next fit policy.
+ *
+ * \param[in] size    number of bytes requested
+ *
+ * \returns   pointer to bytes allocate or NULL if not available
+ *            If NULL returned check mberr code for reason
+ */
+static inline void *
+mballoc_fast(unsigned long size)
+{
+    int         nwords, wi;
+    mb_uint16   mi;
+    mb_word_t   smask;
+    mbspace_t   *space;
+
+    if (size <= MB_SBMAP_BYTES_PERWORD) {
+        space = &mb_cur->space[MB_SMALLBLOCKS];
+        nwords = (size + MB_SBMAP_BYTES_PERNIB - 1) / MB_SBMAP_BYTES_PERNIB;
+    } else if (size <= MB_BBMAP_BYTES_PERWORD) {
+        space = &mb_cur->space[MB_BIGBLOCKS];
+        nwords = (size + MB_BBMAP_BYTES_PERNIB - 1) / MB_BBMAP_BYTES_PERNIB;
+    } else {
+        return mballoc(size);
+    }
+    if (mb_cur->txactive || space->policy != MB_POLICY_NEXTFIT) {
+        return mballoc(size);
+    }
+    if (nwords == 0) {
+        nwords = 1;
+    }
+    nwords = mbrunround(nwords, space->round);
+
+    /* Scan the current map word only, left to right, if the run can fit in it and leaves the reserve */
+    mi = space->mi;
+    smask = MB_MAP_RUNMASK(nwords);
+    if (nwords > space->mifit || space->freenibs < space->reserve + nwords ||
+        (wi = mbspacefit(space, mbmapget(space, mi), smask)) < 0) {
+        return mballoc(size);
+    }
+
+    /* Mark space allocated on map and keep the free run left in the map word */
+    space->bmap[mi] |= smask >> (wi * MB_MAP_BITS_PERNIB);
+    space->mifit = mbspacerun(space, space->bmap[mi]);
+    space->freenibs -= nwords;
+
+    mb_cur->err = MBERR_OK;
+    return &space->block[(mi * space->bytes_perword) + (wi * space->bytes_pernib)];
+}
+
+
+/**
+ * \brief
+ * Convert a compressed offset to a memory block pointer
+ *
+ * \details
+ * The top bit of the offset selects the space, and the rest is the index of
+ * the block's first map nibble in the space.
+ *
+ * \param[in] off     offset returned by mballoc_off() or mbptr2off()
+ *
+ * \returns   pointer to the block or NULL for MB_OFF_NULL
+ */
+static inline void *
+mboff2ptr(mboff_t off)
+{
+    mbspace_t *space;
+
+    if (off == MB_OFF_NULL) {
+        return NULL;
+    }
+    space = &mb_cur->space[off >> MB_OFF_SPACE_SHIFT];
+    return &space->block[(off & MB_OFF_NIB_MASK) * space->bytes_pernib];
+}
+
+
+/**
+ * \brief
+ * Convert a memory block pointer to a compressed offset
+ *
+ * \param[in] mbp     memory block pointer returned by mballoc()
+ *
+ * \returns   offset of the block or MB_OFF_NULL if mbp is not in a block space
+ */
+static inline mboff_t
+mbptr2off(void *mbp)
+{
+    int         i;
+    mbspace_t   *space;
+
+    for (i=0; i < MB_SPACES; i++) {
+        space = &mb_cur->space[i];
+        if ((mb_byte_t *)mbp >= space->block &&
+            (mb_byte_t *)mbp < space->block + (space->mapwords * space->bytes_perword)) {
+            /* small blocks in borrowed big block map words count from the small block area */
+            if (((mb_byte_t *)mbp - space->block) % space->bytes_pernib) {
+                i = MB_SMALLBLOCKS;
+                space = &mb_cur->space[i];
+            }
+            return ((mboff_t)i << MB_OFF_SPACE_SHIFT) |
+                   (mboff_t)(((mb_byte_t *)mbp - space->block) / space->bytes_pernib);
+        }
+    }
+    return MB_OFF_NULL;
+}
+
+#endif /* MBLIB_INLINE_H */
@@ -0,0 +1,216 @@
+/**
+ * \brief
+ * Memory Block Management Library internals
+ *
+ * \details
+ * Map constants, control block types and map word helpers shared by mblib.c
+ * and the white box tests. Not part of the installed interface, programs
+ * include mblib.h and mblib_inline.h.
+ *
+ */
+
+#ifndef MBLIB_INT_H
+#define MBLIB_INT_H
+
+#include "mblib_inline.h"
+
+/** Memblock base types, as the library names them */
+typedef mb_byte_t       mbbyte_t;
+typedef mb_uint16       uint16;
+typedef mb_word_t       mbword_t;
+
+/** Map constants */
+#define     MB_MAPWORD_SIZE             sizeof(mbword_t)
+
+#define     MB_MAP_ALLOC_MIN_WORDS      4
+#define     MB_MAP_ALLOC_MAX_WORDS      32
+
+#define     MB_MAP_ALLOC_LFN_MAP        0xF0000000          /* left most nibble  */
+#define     MB_MAP_ALLOC_MARK           0xF0000000
+#define     MB_MAP_ALLOC_END            0x10000000
+#define     MB_MAP_ALLOC_END_VAL        0x1
+
+#define     MB_TX_LOG_RUNS              64          /* runs logged per allocation transaction */
+
+#define     MB_SLAB_NIL                 0xFFFF      /* end of a slab map word list */
+#define     MB_SLAB_EMPTY               0x00        /* slab map word is on the empty list */
+#define     MB_SLAB_MIXED               0x40        /* slab map word holds runs of any length */
+#define     MB_SLAB_PARTIAL             0x80        /* slab map word is on its partial list */
+
+#define     MB_BORROW_MAPWORDS          (MB_BBMAP_BYTES_PERWORD / MB_SBMAP_BYTES_PERWORD)
+                                                    /* small block map words in a borrowed big block map word */
+
+#define     MB_FULL_PROBES              4           /* map words tried per fullness bucket */
+
+#define     MB_NEAR_PAGE                4096        /* page searched by mballoc_near() */
+
+
+/** \brief
+  * Borrowed big block map word type
+  * \details
+  * space   - Small block space over the borrowed map word, its block is NULL
+  *           while the slot is not in use
+  * bmi     - Big block map word borrowed
+  * map     - Small block map of the borrowed map word
+  * gen     - Map generation of each small block map word
+  * refcnt  - Reference count of each small block map nibble
+  */
+typedef struct {
+    mbspace_t       space;
+    uint16          bmi;
+    mbword_t        map[MB_BORROW_MAPWORDS];
+    uint16          gen[MB_BORROW_MAPWORDS];
+    uint16          refcnt[MB_BORROW_MAPWORDS * MB_MAP_NIB_PERWORD];
+} mbborrow_t;
+
+/** \brief
+  * Movable memory block handle table entry type
+  * \details
+  * ptr     - Current address of the block, NULL if the handle is free
+  * pins    - Number of outstanding pins, the block is not moved while pinned
+  * next    - Next free handle when the handle is free
+  */
+typedef struct {
+    void            *ptr;
+    unsigned int    pins;
+    mbhandle_t      next;
+} mbhent_t;
+
+/** \brief
+  * Movable memory block handle table type
+  * \details
+  * ent     - Handle table entries, handle h is entry h-1
+  * size    - Number of handle table entries
+  * used    - Number of entries handed out at least once
+  * free    - First free handle to reuse, 0 if none
+  * cur     - Entry where the next compaction starts
+  */
+typedef struct {
+    mbhent_t        *ent;
+    unsigned int    size;
+    unsigned int    used;
+    mbhandle_t      free;
+    unsigned int    cur;
+} mbhtab_t;
+
+/** \brief
+  * Allocation transaction log entry type
+  * \details
+  * space   - Space of the allocated run
+  * mi      - Map word index of the allocated run
+  * nibs    - Map word mask of all nibbles of the allocated run
+  */
+typedef struct {
+    mbspace_t       *space;
+    uint16          mi;
+    mbword_t        nibs;
+} mbtxent_t;
+
+/** \brief
+  * Allocation transaction type
+  * \details
+  * active  - Set while a transaction is active
+  * n       - Number of logged runs
+  * log     - Runs allocated in the transaction
+  */
+typedef struct {
+    int             active;
+    int             n;
+    mbtxent_t       log[MB_TX_LOG_RUNS];
+} mbtx_t;
+
+/** \brief 
+  * Memory block libary control block type
+  * \details
+  * err      - Last recorded error
+  * space    - Array of memory spaces 
+  * tx       - Allocation transaction, its active flag is the txactive
+  *            member of mbfast_t
+  * fallback - Free function for memory not owned by mblib, or NULL
+  * htab     - Movable memory block handles
+  * parent   - Parent instance of a child instance, NULL for the root instance
+  * pmi      - First parent big block map word holding a child instance
+  * pwords   - Number of parent big block map words holding a child instance
+  * child    - First child instance, NULL if none
+  * next     - Next child instance of the same parent
+  * borrow   - Slots for big block map words borrowed by the small block space
+  * nborrow  - Number of borrow slots
+  * borrowed - Number of borrow slots in use
+  */
+typedef struct mbcb_s {
+    MBERR           err;
+    mbspace_t       space[MB_SPACES];
+    mbtx_t          tx;
+    void            (*fallback)(void *);
+    mbhtab_t        htab;
+    struct mbcb_s   *parent;
+    uint16          pmi;
+    uint16          pwords;
+    struct mbcb_s   *child;
+    struct mbcb_s   *next;
+    mbborrow_t      *borrow;
+    int             nborrow;
+    int             borrowed;
+} mbcb_t;
+
+/** \brief Current memory block libary instance */
+#define     mbcur                       ((mbcb_t *)mb_cur)
+
+
+/**
+ * \brief
+ * Return an incremented map index
+ *
+ * \details
+ * Increment the given map index, and wrap if needed 
+ */
+static inline uint16
+mbimapinc(uint16 mi, uint16 mapwords)
+{
+    return (++mi < mapwords ? mi : 0);
+}
+
+
+/**
+ * \brief
+ * Return a decremented map index
+ *
+ * \details
+ * Decrement the given map index, and wrap if needed
+ */
+static inline uint16
+mbimapdec(uint16 mi, uint16 mapwords)
+{
+    return (mi ? mi - 1 : mapwords - 1);
+}
+
+
+/**
+ * \brief
+ * Get the run length of a block size
+ *
+ * \details
+ * Returns the number of map nibbles mballoc() claims in the space for a block
+ * of the given size, which must fit the space
+ */
+static inline int
+mbrunlen(const mbspace_t *space, unsigned long size)
+{
+    int n;
+
+    n = (size + space->bytes_pernib - 1) / space->bytes_pernib;
+    return mbrunround(n ? n : 1, space->round);
+}
+
+
+/**
+ * \brief
+ * Count the free nibbles of a map word
+ */
+static inline int
+mbwordfree(mbword_t mword)
+{
+    return __builtin_popcount(~(mword | (mword >> 1) | (mword >> 2) | (mword >> 3)) & 0x11111111);
+}
+
+#endif /* MBLIB_INT_H */
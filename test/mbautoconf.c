@@ -0,0 +1,200 @@
+/**
+ * \brief
+ * Memory Block Management Library Auto Configuration Tool
+ *
+ * \details
+ * Reads a size histogram or an allocation trace and prints the instance
+ * configuration mbautoconf() recommends for it, ready to pass to mbinit_ex().
+ *
+ * A histogram has one "size live" line per allocation size, with the average
+ * number of live blocks of the size. A trace has "a id size" lines for
+ * allocations and "f id" lines for frees, and the live blocks of each size
+ * are averaged over the trace events.
+ *
+ *  mbautoconf [-p nomem] [file]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../mblib.h"
+
+#define MAXSIZE     2048            /* biggest block size */
+
+
+/** trace blocks live by id, open addressed */
+static unsigned long    *ids;
+static unsigned int     *sizes;
+static unsigned long    nids, used;
+
+static unsigned long    live[MAXSIZE + 1];      /* blocks of each size live now */
+static double           sum[MAXSIZE + 1];       /* live blocks of each size summed over events */
+static unsigned long    last[MAXSIZE + 1];      /* event the size was last summed at */
+static unsigned long    events;
+
+
+/**
+ * \brief Find the slot of a trace block id
+ */
+static unsigned long
+slot(unsigned long id)
+{
+    unsigned long i;
+
+    for (i = (id * 0x9E3779B97F4A7C15UL) & (nids - 1); sizes[i] && ids[i] != id; i = (i + 1) & (nids - 1))
+        ;
+    return i;
+}
+
+
+/**
+ * \brief Change the live blocks of a size, summing the ones live since its last change
+ */
+static void
+change(unsigned int size, int by)
+{
+    sum[size] += (double)live[size] * (events - last[size]);
+    last[size] = events;
+    live[size] += by;
+}
+
+
+/**
+ * \brief Record a trace allocation
+ */
+static void
+alloc(unsigned long id, unsigned int size)
+{
+    unsigned long   i, n, *oids;
+    unsigned int    *osizes;
+
+    /* keep the table at most half full */
+    if (2 * (used + 1) > nids) {
+        oids = ids;
+        osizes = sizes;
+        n = nids;
+        nids = nids ? 2 * nids : 1024;
+        ids = calloc(nids, sizeof(*ids));
+        sizes = calloc(nids, sizeof(*sizes));
+        for (i=0; i < n; i++) {
+            if (osizes[i]) {
+                ids[slot(oids[i])] = oids[i];
+                sizes[slot(oids[i])] = osizes[i];
+            }
+        }
+        free(oids);
+        free(osizes);
+    }
+
+    i = slot(id);
+    if (sizes[i] == 0) {
+        used++;
+    } else {
+        change(sizes[i], -1);
+    }
+    ids[i] = id;
+    sizes[i] = size ? size : 1;
+    change(sizes[i], 1);
+}
+
+
+/**
+ * \brief Record a trace free, backward shifting the blocks after it
+ */
+static void
+release(unsigned long id)
+{
+    unsigned long i, j, h;
+
+    if (nids == 0 || sizes[i = slot(id)] == 0) {
+        return;
+    }
+    change(sizes[i], -1);
+    sizes[i] = 0;
+    used--;
+    for (j = (i + 1) & (nids - 1); sizes[j]; j = (j + 1) & (nids - 1)) {
+        h = (ids[j] * 0x9E3779B97F4A7C15UL) & (nids - 1);
+        if (((j - h) & (nids - 1)) >= ((j - i) & (nids - 1))) {
+            ids[i] = ids[j];
+            sizes[i] = sizes[j];
+            sizes[j] = 0;
+            i = j;
+        }
+    }
+}
+
+
+int main(int argc, char *argv[])
+{
+    int             i, n;
+    char            line[256], op;
+    double          nomem, count;
+    unsigned long   id, size;
+    FILE            *in;
+    mbconfig_t      config;
+    static mbhist_t hist[2 * MAXSIZE];
+    static const char *policyname[] = { "MB_POLICY_NEXTFIT", "MB_POLICY_FIRSTFIT", "MB_POLICY_BESTFIT",
+                                        "MB_POLICY_SLAB", "MB_POLICY_FULLEST" };
+    static const char *roundname[] = { "MB_ROUND_NONE", "MB_ROUND_EVEN", "MB_ROUND_POW2" };
+
+    nomem = 0.001;
+    if (argc > 2 && strcmp(argv[1], "-p") == 0) {
+        nomem = atof(argv[2]);
+        argc -= 2;
+        argv += 2;
+    }
+    in = (argc > 1) ? fopen(argv[1], "r") : stdin;
+    if (in == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    n = 0;
+    while (fgets(line, sizeof(line), in)) {
+        if (sscanf(line, "a %lu %lu", &id, &size) == 2) {
+            if (size > MAXSIZE) {
+                fprintf(stderr, "Block of %lu bytes is too big\n", size);
+                return 1;
+            }
+            events++;
+            alloc(id, size);
+        } else if (sscanf(line, "f %lu", &id) == 1) {
+            events++;
+            release(id);
+        } else if (sscanf(line, "%lu %lf", &size, &count) == 2 && n < MAXSIZE) {
+            hist[n].size = size;
+            hist[n].live = count;
+            n++;
+        } else if (sscanf(line, " %c", &op) == 1 && op != '#') {
+            fprintf(stderr, "Cannot read line: %s", line);
+            return 1;
+        }
+    }
+
+    /* a trace is averaged over its events */
+    for (size=1; size <= MAXSIZE && events; size++) {
+        change(size, 0);
+        if (sum[size] > 0) {
+            hist[n].size = size;
+            hist[n].live = sum[size] / events;
+            n++;
+        }
+    }
+
+    if (!mbautoconf(hist, n, nomem, &config)) {
+        fprintf(stderr, "%s\n", mberrstr(mberr()));
+        return 1;
+    }
+
+    for (i=0, count=0; i < n; i++) {
+        count += hist[i].size * hist[i].live;
+    }
+    printf("/* %d sizes, %.0f bytes live, %d KiB of blocks at NOMEM probability %g */\n", n, count,
+           config.k_sb_smallest * 16 + config.k_bb_smallest * 256, nomem);
+    printf("mbconfig_t config = { %d, %d, %d, %s, %s, %d, %s, %s, %d, %d, %d };\n",
+           config.k_sb_smallest, config.k_bb_smallest, config.refs,
+           policyname[config.sb_policy], policyname[config.bb_policy], config.align,
+           roundname[config.sb_round], roundname[config.bb_round], config.borrow,
+           config.sb_reserve, config.bb_reserve);
+    return 0;
+}
@@ -0,0 +1,122 @@
+/**
+ * \brief
+ * Memory Block Management Library Soak Benchmark
+ *
+ * \details
+ * Runs the same random allocate and free workload with each placement policy
+ * and rounding mode, and reports the time taken, the allocations that failed,
+ * the map words next fit searched, the internal waste of the live blocks and
+ * how fragmented the spaces are at the end
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../mblib.h"
+#include "../mblib_int.h"
+
+/* k small blocks and k big blocks to allocate */
+#define KSB     64
+#define KBB     32
+
+#define LIVE    12000           /* blocks kept live */
+#define OPS     4000000         /* allocate and free operations */
+
+static const char *policyname[] = { "next fit", "first fit", "best fit", "slab", "fullest" };
+static const char *roundname[] = { "none", "even", "pow2" };
+
+
+/**
+ * \brief Count the empty map words and free nibbles of a space
+ */
+void
+frag(mbspace_t *space, int *empty, int *freenibs)
+{
+    int         i, j;
+    mbword_t    mword;
+
+    *empty = *freenibs = 0;
+    for (i=0; i < space->mapwords; i++) {
+        mword = mbmapget(space, i);
+        *empty += (mword == 0);
+        for (j=0; j < MB_MAP_NIB_PERWORD; j++) {
+            *freenibs += !(mword & (MB_MAP_ALLOC_LFN_MAP >> (j * MB_MAP_BITS_PERNIB)));
+        }
+    }
+}
+
+
+/**
+ * \brief Run the workload with a placement policy and rounding mode for both spaces
+ */
+void
+soak(int policy, int round)
+{
+    int             i, n, fails, empty, freenibs;
+    unsigned long   size, used, asked;
+    double          secs;
+    struct timespec start, end;
+    static void     *p[LIVE];
+    static unsigned long req[LIVE];
+    mbconfig_t      config = { KSB, KBB, 0, policy, policy, 0, round, round };
+
+    mbinit_ex(&config);
+    memset(p, 0, sizeof(p));
+    srand(1);
+    fails = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (n=0; n < OPS; n++) {
+        i = rand() % LIVE;
+        if (p[i]) {
+            mbfree(p[i]);
+            p[i] = NULL;
+            continue;
+        }
+        /* mostly small blocks, with a tail of big ones */
+        size = (rand() % 4) ? 16 + rand() % 112 : 256 + rand() % 1792;
+        if ((p[i] = mballoc(size)) == NULL) {
+            fails++;
+        }
+        req[i] = size;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    /* internal waste is the part of the live blocks that was not asked for */
+    for (i=0, used=0, asked=0; i < LIVE; i++) {
+        if (p[i]) {
+            used += mbsize(p[i]);
+            asked += req[i];
+        }
+    }
+
+    printf("%-10s %-6s %8.3f %8d %10lu %6.1f%%", policyname[policy], roundname[round], secs, fails,
+           mbcur->space[MB_SMALLBLOCKS].scanned + mbcur->space[MB_BIGBLOCKS].scanned,
+           100.0 * (used - asked) / used);
+    frag(&mbcur->space[MB_SMALLBLOCKS], &empty, &freenibs);
+    printf(" %11d/%-10d", empty, freenibs);
+    frag(&mbcur->space[MB_BIGBLOCKS], &empty, &freenibs);
+    printf(" %11d/%-10d\n", empty, freenibs);
+
+    mbterm();
+}
+
+
+int main()
+{
+    int policy, round;
+
+    printf("%-10s %-6s %8s %8s %10s %7s %22s %22s\n", "policy", "round", "secs", "fails", "scanned", "waste",
+           "small empty/free nibs", "big empty/free nibs");
+    for (policy = MB_POLICY_NEXTFIT; policy <= MB_POLICY_FULLEST; policy++) {
+        soak(policy, MB_ROUND_NONE);
+    }
+    for (round = MB_ROUND_EVEN; round <= MB_ROUND_POW2; round++) {
+        for (policy = MB_POLICY_NEXTFIT; policy <= MB_POLICY_FULLEST; policy++) {
+            soak(policy, round);
+        }
+    }
+    return 0;
+}
@@ -9,8 +9,18 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <pthread.h>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
 
 #include "../mblib.h"
+#include "../mblib_int.h"
 
 /**
  * \brief Fill space with a known data pattern
@@ -36,6 +46,110 @@ verify(unsigned char *dp, int size)
     }
 }
 
+
+#ifdef __linux__
+/**
+ * \brief Minimal io_uring instance used to test fixed buffer I/O
+ */
+static struct {
+    int                     fd;
+    struct io_uring_params  p;
+    unsigned char           *sq, *cq;
+    struct io_uring_sqe     *sqes;
+} uring;
+
+
+/**
+ * \brief Set up the test io_uring instance, return 0 if io_uring is not available
+ */
+int
+uring_setup(void)
+{
+    size_t sqsz, cqsz;
+
+    memset(&uring, 0, sizeof(uring));
+    uring.fd = syscall(__NR_io_uring_setup, 4, &uring.p);
+    if (uring.fd < 0) {
+        return 0;
+    }
+    sqsz = uring.p.sq_off.array + uring.p.sq_entries * sizeof(unsigned);
+    cqsz = uring.p.cq_off.cqes + uring.p.cq_entries * sizeof(struct io_uring_cqe);
+    if (uring.p.features & IORING_FEAT_SINGLE_MMAP) {
+        sqsz = cqsz = (sqsz > cqsz) ? sqsz : cqsz;
+    }
+    uring.sq = mmap(NULL, sqsz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring.fd, IORING_OFF_SQ_RING);
+    uring.cq = (uring.p.features & IORING_FEAT_SINGLE_MMAP) ? uring.sq :
+               mmap(NULL, cqsz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring.fd, IORING_OFF_CQ_RING);
+    uring.sqes = mmap(NULL, uring.p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, uring.fd, IORING_OFF_SQES);
+    assert(uring.sq != MAP_FAILED && uring.cq != MAP_FAILED && uring.sqes != MAP_FAILED);
+    return 1;
+}
+
+
+/**
+ * \brief Do one fixed buffer read or write on the test io_uring instance and return its result
+ */
+int
+uring_fixed(int op, int fd, void *buf, unsigned int len, unsigned long off)
+{
+    unsigned int            tail, sqidx, bufidx, head;
+    unsigned int            *sqtail, *cqhead;
+    unsigned long           bufoff;
+    struct io_uring_sqe     *sqe;
+    struct io_uring_cqe     *cqe;
+
+    assert(mburing_buf(buf, &bufidx, &bufoff));
+    sqtail = (unsigned int *)(uring.sq + uring.p.sq_off.tail);
+    tail = *sqtail;
+    sqidx = tail & *(unsigned int *)(uring.sq + uring.p.sq_off.ring_mask);
+    sqe = &uring.sqes[sqidx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = op;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long)buf;
+    sqe->len = len;
+    sqe->off = off;
+    sqe->buf_index = bufidx;
+    ((unsigned int *)(uring.sq + uring.p.sq_off.array))[sqidx] = sqidx;
+    __atomic_store_n(sqtail, tail + 1, __ATOMIC_RELEASE);
+
+    assert(syscall(__NR_io_uring_enter, uring.fd, 1, 1, IORING_ENTER_GETEVENTS, NULL, 0) == 1);
+    cqhead = (unsigned int *)(uring.cq + uring.p.cq_off.head);
+    head = __atomic_load_n(cqhead, __ATOMIC_ACQUIRE);
+    cqe = &((struct io_uring_cqe *)(uring.cq + uring.p.cq_off.cqes))
+            [head & *(unsigned int *)(uring.cq + uring.p.cq_off.ring_mask)];
+    __atomic_store_n(cqhead, head + 1, __ATOMIC_RELEASE);
+    return cqe->res;
+}
+#endif
+
+/**
+ * \brief Block channel sender thread argument
+ */
+typedef struct {
+    mbchan_t    *chan;
+    void        **blks;
+    int         n;
+} sender_t;
+
+
+/**
+ * \brief Send blocks on a channel in small batches
+ */
+void *
+sender(void *arg)
+{
+    int         i, sent;
+    sender_t    *s = arg;
+
+    for (i=0; i < s->n; i += sent) {
+        sent = mbchan_send(s->chan, &s->blks[i], (s->n - i < 7) ? s->n - i : 7);
+    }
+    return NULL;
+}
+
+
 /* k small blocks and k big blocks to allocate */
 #define KSB     2
 #define KBB     3
@@ -169,5 +283,919 @@ int main()
     mbdumpstat();
     assert(mbtestfree());
 
+    printf("\nTest 4 - Allocate constant sizes with the inline fast path and mix with mballoc\n");
+    printf("allocating and writing...\n");
+    i = 0;
+    while (1) {
+        sz[i] = (i & 1) ? 48 : 512;
+        p[i] = (i & 1) ? mballoc_fast(48) : mballoc_fast(512);
+        if (p[i] == NULL) {
+            assert(mberr() == MBERR_NOMEM);
+            break;
+        }
+        fill(p[i], sz[i]);
+        i++;
+        if ((i % 3) == 0) {
+            sz[i] = 16;
+            if (NULL == (p[i] = mballoc(16))) {
+                break;
+            }
+            fill(p[i++], 16);
+        }
+    }
+    assert(mballoc_fast(4096) == NULL && mberr() == MBERR_BIG);
+    mbdumpstat();
+    printf("verifying and freeing...\n");
+    for (j=0; j < i; j++) {
+        verify(p[j], sz[j]);
+        mbfree(p[j]);
+    }
+    assert(mbtestfree());
+
+    printf("\nTest 5 - Check usable block sizes against rounded allocation sizes\n");
+    for (i=0; i < 20; i++) {
+        p[i] = mballoc(mballocsz[i]);
+        if (p[i]) {
+            assert(mbsize(p[i]) == mbgoodsize(mballocsz[i]));
+            assert(mbsize(p[i]) >= mballocsz[i]);
+            fill(p[i], mbsize(p[i]));
+        } else {
+            assert(mbgoodsize(mballocsz[i]) == 0 && mberr() == MBERR_BIG);
+        }
+    }
+    assert(mbgoodsize(129) == 256 && mbgoodsize(0) == 16 && mbgoodsize(2048) == 2048);
+    for (i=0; i < 20; i++) {
+        if (p[i]) {
+            verify(p[i], mbsize(p[i]));
+            mbfree(p[i]);
+        }
+    }
+    assert(mbtestfree());
+
+    printf("\nTest 6 - Check ownership and free of memory not owned by mblib\n");
+    p[0] = mballoc(16);
+    p[1] = mballoc(2048);
+    p[2] = malloc(64);
+    assert(mbowns(p[0]) && mbowns(p[1]) && !mbowns(p[2]) && !mbowns(&i));
+    mbfree(p[2]);
+    assert(mberr() == MBERR_UNKNOWN);
+    mbsetfallback(free);
+    mbfree(p[2]);
+    mbfree(p[1]);
+    mbfree(p[0]);
+    mbsetfallback(NULL);
+    assert(mbtestfree());
+
+    printf("\nTest 7 - Allocate movable blocks, free most of them and compact the rest\n");
+    {
+        mbhandle_t  h[64];
+        void        *pinned;
+        int         moved;
+
+        mbhinit(64);
+        for (i=0; i < 64; i++) {
+            h[i] = mbhalloc(16);
+            assert(h[i]);
+            fill(mbhpin(h[i]), 16);
+            mbhunpin(h[i]);
+        }
+        assert(mbhalloc(16) == 0 && mberr() == MBERR_NOMEM);
+        for (i=0; i < 64; i++) {
+            if (i % 8) {
+                mbhfree(h[i]);
+            }
+        }
+        pinned = mbhpin(h[56]);
+        moved = 0;
+        for (j=0; j < 100; j++) {
+            moved += mbcompact(32);
+        }
+        printf("moved %d blocks\n", moved);
+        assert(moved > 0);
+        assert(mbhpin(h[56]) == pinned);
+        mbhunpin(h[56]);
+        mbhunpin(h[56]);
+        for (i=0; i < 64; i += 8) {
+            verify(mbhpin(h[i]), 16);
+            mbhunpin(h[i]);
+            mbhfree(h[i]);
+        }
+        assert(mbhpin(h[0]) == NULL && mberr() == MBERR_UNKNOWN);
+
+        /* initializing again frees the blocks of live handles */
+        h[0] = mbhalloc(32);
+        h[1] = mbhalloc(512);
+        mbhinit(4);
+        assert(mbtestfree());
+
+        /* aborting a transaction frees the handles allocated in it */
+        h[0] = mbhalloc(16);
+        mbtx_begin();
+        h[1] = mbhalloc(48);
+        h[2] = mbhalloc(768);
+        mbtx_abort();
+        assert(mbhpin(h[1]) == NULL && mbhpin(h[2]) == NULL && mberr() == MBERR_UNKNOWN);
+        assert(mbhpin(h[0]) != NULL);
+        mbhunpin(h[0]);
+        mbhfree(h[0]);
+    }
+    assert(mbtestfree());
+
+    printf("\nTest 8 - Allocate scratch objects from a bump arena and release them at once\n");
+    {
+        mbarena_t   arena;
+
+        mbarena_init(&arena);
+
+        /* empty allocations on a fresh arena still get distinct blocks */
+        p[0] = mbarena_alloc(&arena, 0);
+        p[1] = mbarena_alloc(&arena, 0);
+        assert(p[0] && p[1] && (mbbyte_t *)p[1] == (mbbyte_t *)p[0] + MB_ARENA_ALIGN);
+
+        for (i=0; i < 200; i++) {
+            sz[i] = 8 + (i % 13) * 24;
+            p[i] = mbarena_alloc(&arena, sz[i]);
+            assert(p[i] && mbowns(p[i]));
+            assert(((unsigned long)p[i] % MB_ARENA_ALIGN) == 0);
+            fill(p[i], sz[i]);
+        }
+        assert(mbarena_alloc(&arena, 4096) == NULL && mberr() == MBERR_BIG);
+        for (i=0; i < 200; i++) {
+            verify(p[i], sz[i]);
+        }
+        printf("arena took %d runs\n", arena.nruns);
+        mbarena_release(&arena);
+        assert(arena.nruns == 0);
+
+        /* with no map word free a refill takes only the run the allocation needs */
+        for (i=0; (p[i] = mballoc(1792)) != NULL; i++)
+            ;
+        p[i] = mbarena_alloc(&arena, 100);
+        assert(p[i] && arena.nruns == 1 && arena.left == 256 - 112);
+        mbarena_release(&arena);
+        mbfree_n(p, i);
+
+        /* a refill keeps the error of mballoc() */
+        mbtx_begin();
+        for (i=0; i < MB_TX_LOG_RUNS; i++) {
+            p[i] = mballoc(16);
+        }
+        assert(mbarena_alloc(&arena, 16) == NULL && mberr() == MBERR_TX);
+        mbtx_abort();
+    }
+    assert(mbtestfree());
+
+    printf("\nTest 9 - Fill both spaces and free everything at once with a reset\n");
+    for (j=0; j < 3; j++) {
+        i = 0;
+        while (NULL != (p[i] = mballoc(16 * ((i % 8) + 1)))) {
+            fill(p[i], 16 * ((i % 8) + 1));
+            i++;
+        }
+        while (NULL != (p[i] = mballoc(256 * ((i % 8) + 1)))) {
+            i++;
+        }
+        assert(!mbtestfree());
+        mbreset();
+        assert(mbtestfree());
+    }
+    p[0] = mballoc(2048);
+    assert(p[0] && mbsize(p[0]) == 2048);
+    for (i=0; i < 65536; i++) {
+        mbreset();
+    }
+    assert(mbtestfree());
+
+    printf("\nTest 10 - Abort and commit allocation transactions\n");
+    p[0] = mballoc(64);
+    mbtx_begin();
+    mbtx_begin();
+    assert(mberr() == MBERR_TX);
+    for (i=1; i <= MB_TX_LOG_RUNS; i++) {
+        p[i] = (i & 1) ? mballoc(48) : mballoc_fast(768);
+        assert(p[i]);
+    }
+    assert(mballoc(16) == NULL && mberr() == MBERR_TX);
+    mbfree(p[2]);
+    mbtx_abort();
+    mbfree(p[0]);
+    assert(mbtestfree());
+    mbtx_begin();
+    p[0] = mballoc(64);
+    p[1] = mballoc(512);
+    mbtx_commit();
+    mbtx_abort();
+    assert(mbsize(p[0]) == 64 && mbsize(p[1]) == 512);
+    mbfree(p[0]);
+    mbfree(p[1]);
+    assert(mbtestfree());
+
+    printf("\nTest 11 - Create a child instance inside the big block space and fill it\n");
+    {
+        mbconfig_t  config = { 1, 1 };
+        mbctx_t     *child, *grand, *root;
+        void        *blk;
+
+        blk = mballoc(2048);
+        child = mbcreate_in(NULL, &config);
+        assert(child && !mbtestfree());
+        root = mbuse(child);
+        assert(mbtestfree());
+        i = 0;
+        while (NULL != (p[i] = mballoc(16))) {
+            fill(p[i++], 16);
+        }
+        assert(i == 1024 && mberr() == MBERR_NOMEM);
+        for (j=0; j < i; j++) {
+            verify(p[j], 16);
+        }
+        mbreset();
+        assert(mbtestfree());
+        assert(mbuse(root) == child);
+        assert(mbowns(p[0]));
+        mbdestroy(child);
+        mbfree(blk);
+        assert(mbtestfree());
+        config.k_bb_smallest = KBB;
+        assert(mbcreate_in(NULL, &config) == NULL && mberr() == MBERR_NOMEM);
+
+        /* destroying a child destroys its children, even the current one */
+        config.k_bb_smallest = 2;
+        child = mbcreate_in(NULL, &config);
+        config.k_bb_smallest = 1;
+        grand = mbcreate_in(child, &config);
+        assert(child && grand);
+        root = mbuse(grand);
+        mbhinit(16);
+        assert(mbhalloc(16));
+        mbdestroy(child);
+        assert(mbuse(NULL) == root);
+    }
+    assert(mbtestfree());
+
+    printf("\nTest 12 - Share reference counted blocks\n");
+    assert(mbref_alloc(64) == NULL && mberr() == MBERR_CONFIG);
+    mbterm();
+    {
+        mbconfig_t  config = { KSB, KBB, 1 };
+
+        mbinit_ex(&config);
+        for (i=0; i < 100; i++) {
+            p[i] = mbref_alloc((i & 1) ? 100 : 1000);
+            assert(p[i] && mbref_count(p[i]) == 1);
+            fill(p[i], (i & 1) ? 100 : 1000);
+            for (j=0; j < i % 4; j++) {
+                mbref_get(p[i]);
+            }
+        }
+        for (i=0; i < 100; i++) {
+            assert(mbref_count(p[i]) == 1 + (i % 4));
+            for (j=0; j < i % 4; j++) {
+                mbref_put(p[i]);
+                verify(p[i], (i & 1) ? 100 : 1000);
+            }
+            assert(!mbtestfree());
+            mbref_put(p[i]);
+        }
+
+        /* the count stops at its maximum rather than wrap */
+        p[0] = mbref_alloc(16);
+        for (i=1; i < 0xFFFF; i++) {
+            assert(mbref_get(p[0]));
+        }
+        assert(!mbref_get(p[0]) && mberr() == MBERR_REFS);
+        assert(mbref_count(p[0]) == 0xFFFF);
+        for (i=0; i < 0xFFFF; i++) {
+            mbref_put(p[0]);
+        }
+    }
+    assert(mbtestfree());
+
+    printf("\nTest 13 - Append, slice, consume and write out a chained buffer, then read it back\n");
+    {
+        mbchain_t       chain, slice, back;
+        struct iovec    iov[MB_CHAIN_SEGS];
+        unsigned char   data[10000], *bp;
+        FILE            *fp;
+        int             n;
+
+        fill(data, sizeof(data));
+        mbchain_init(&chain);
+        for (i=0; i < sizeof(data); i += 999) {
+            j = (sizeof(data) - i < 999) ? sizeof(data) - i : 999;
+            assert(mbchain_append(&chain, data + i, j) == j);
+        }
+        assert(chain.len == sizeof(data));
+
+        assert(mbchain_slice(&chain, 1000, 3000, &slice) == 3000);
+        n = mbchain_iov(&slice, iov, MB_CHAIN_SEGS);
+        for (i=0, j=1000; i < n; j += iov[i++].iov_len) {
+            assert(memcmp(iov[i].iov_base, data + j, iov[i].iov_len) == 0);
+        }
+        assert(j == 4000);
+        assert(mbchain_consume(&chain, 2500) == 2500);
+        assert(mbchain_append(&slice, data, 100) == 100);
+
+        fp = tmpfile();
+        n = mbchain_iov(&chain, iov, MB_CHAIN_SEGS);
+        assert(writev(fileno(fp), iov, n) == sizeof(data) - 2500);
+        rewind(fp);
+        mbchain_init(&back);
+        n = mbchain_recv_iov(&back, sizeof(data) - 2500, iov, MB_CHAIN_SEGS);
+        j = readv(fileno(fp), iov, n);
+        assert(j == sizeof(data) - 2500);
+        mbchain_commit(&back, j);
+        fclose(fp);
+        assert(back.len == sizeof(data) - 2500);
+        n = mbchain_iov(&back, iov, MB_CHAIN_SEGS);
+        for (i=0, bp = data + 2500; i < n; bp += iov[i++].iov_len) {
+            assert(memcmp(iov[i].iov_base, bp, iov[i].iov_len) == 0);
+        }
+
+        /* payloads over the room left in a chain are refused whole */
+        assert(mbchain_append(&chain, data, MB_CHAIN_MAX) == 0 && mberr() == MBERR_BIG);
+        assert(chain.len == sizeof(data) - 2500);
+        assert(mbchain_recv_iov(&back, MB_CHAIN_MAX, iov, MB_CHAIN_SEGS) == 0 && mberr() == MBERR_BIG);
+
+        mbchain_free(&chain);
+        assert(!mbtestfree());
+        mbchain_free(&slice);
+        mbchain_free(&back);
+    }
+    assert(mbtestfree());
+
+#ifdef __linux__
+    printf("\nTest 14 - Write and read blocks to a file with io_uring fixed buffers\n");
+    {
+        unsigned int    idx;
+        unsigned long   off;
+        FILE            *fp;
+
+        p[0] = mballoc(2048);
+        p[1] = mballoc(100);
+        assert(mburing_buf(p[0], &idx, &off) && idx == 1 && off < KBB * 1024 * 256);
+        assert(mburing_buf(p[1], &idx, &off) && idx == 0 && off < KSB * 1024 * 16);
+        assert(!mburing_buf(&i, &idx, &off));
+        if (uring_setup() && mburing_register(uring.fd)) {
+            fp = tmpfile();
+            fill(p[0], 2048);
+            fill(p[1], 100);
+            assert(uring_fixed(IORING_OP_WRITE_FIXED, fileno(fp), p[0], 2048, 0) == 2048);
+            assert(uring_fixed(IORING_OP_WRITE_FIXED, fileno(fp), p[1], 100, 2048) == 100);
+            memset(p[0], 0, 2048);
+            memset(p[1], 0, 100);
+            assert(uring_fixed(IORING_OP_READ_FIXED, fileno(fp), p[1], 100, 2048) == 100);
+            assert(uring_fixed(IORING_OP_READ_FIXED, fileno(fp), p[0], 2048, 0) == 2048);
+            verify(p[0], 2048);
+            verify(p[1], 100);
+            assert(mburing_unregister(uring.fd));
+            fclose(fp);
+            close(uring.fd);
+        } else {
+            printf("io_uring not available: %s\n", mberrstr(mberr()));
+        }
+        mbfree(p[0]);
+        mbfree(p[1]);
+    }
+    assert(mbtestfree());
+#endif
+
+    printf("\nTest 15 - Hand blocks from two sender threads to the main thread over a channel\n");
+    {
+        mbchan_t    chan;
+        sender_t    s[2];
+        pthread_t   tid[2];
+        void        *got[1000];
+        int         n;
+
+        assert(mbchan_init(&chan, 60));
+        assert(chan.mask == 63);
+        for (i=0; i < 1000; i++) {
+            p[i] = mballoc(32);
+            fill(p[i], 32);
+        }
+        for (i=0; i < 2; i++) {
+            s[i].chan = &chan;
+            s[i].blks = &p[i * 500];
+            s[i].n = 500;
+            pthread_create(&tid[i], NULL, sender, &s[i]);
+        }
+        for (n=0; n < 1000; n += mbchan_recv(&chan, &got[n], 1000 - n))
+            ;
+        for (i=0; i < 2; i++) {
+            pthread_join(tid[i], NULL);
+        }
+        assert(mbchan_recv(&chan, got, 1) == 0);
+        for (i=0; i < 1000; i++) {
+            verify(got[i], 32);
+        }
+        mbfree_n(got, 1000);
+        mbchan_term(&chan);
+    }
+    assert(mbtestfree());
+
+#ifdef __linux__
+    printf("\nTest 16 - Stream records that wrap through a mirrored byte ring\n");
+    {
+        mbring_t        ring;
+        unsigned char   *rec;
+        unsigned long   len;
+
+        assert(mbring_init(&ring, 4096));
+        for (i=0; i < 100; i++) {
+            len = 100 + (i * 37) % 1500;
+            rec = mbring_reserve(&ring, len);
+            assert(rec);
+            fill(rec, len);
+            mbring_commit(&ring, len);
+            rec = mbring_peek(&ring, &len);
+            assert(len == 100 + (i * 37) % 1500);
+            verify(rec, len);
+            mbring_consume(&ring, len);
+        }
+        assert(ring.head > ring.size);
+        assert(!mbring_reserve(&ring, ring.size + 1) && mberr() == MBERR_NOMEM);
+        mbring_term(&ring);
+    }
+#endif
+
+    printf("\nTest 17 - Allocate and free blocks by compressed offsets\n");
+    {
+        mboff_t off[100];
+
+        for (i=0; i < 100; i++) {
+            off[i] = mballoc_off(i % 2 ? 48 : 1024);
+            assert(off[i] != MB_OFF_NULL);
+            assert(mbptr2off(mboff2ptr(off[i])) == off[i]);
+            fill(mboff2ptr(off[i]), i % 2 ? 48 : 1024);
+        }
+        assert(off[0] >> 31 == 1 && off[1] >> 31 == 0);
+        assert(mbptr2off(&i) == MB_OFF_NULL && mboff2ptr(MB_OFF_NULL) == NULL);
+        assert(mballoc_off(4096) == MB_OFF_NULL && mberr() == MBERR_BIG);
+        for (i=0; i < 100; i++) {
+            verify(mboff2ptr(off[i]), i % 2 ? 48 : 1024);
+            mbfree_off(off[i]);
+        }
+    }
+    assert(mbtestfree());
+
+    printf("\nTest 18 - Allocate blocks near a hint block\n");
+    {
+        unsigned char *hint;
+
+        hint = mballoc(16);
+        for (i=0; i < 100; i++) {
+            p[i] = mballoc(64);
+        }
+        p[100] = mballoc_near(16, hint);
+        assert(mbptr2off(p[100]) / 8 == mbptr2off(hint) / 8);
+        for (i=101; i < 110; i++) {
+            p[i] = mballoc_near(16, hint);
+            assert(p[i] && labs((unsigned char *)p[i] - hint) < 4096 + 128);
+        }
+        p[110] = mballoc_near(1024, hint);
+        assert(p[110] && mberr() == MBERR_OK);
+        p[111] = mballoc_near(16, NULL);
+        assert(p[111]);
+        mbfree_n(p, 112);
+        mbfree(hint);
+    }
+    assert(mbtestfree());
+
+    printf("\nTest 19 - Separate long and short lived blocks with lifetime hints\n");
+    {
+        for (i=0; i < 200; i++) {
+            p[i] = mballoc_hint(512, i % 2 ? MB_LIFETIME_SHORT : MB_LIFETIME_LONG);
+            assert(p[i]);
+        }
+        /* long lived blocks pack the first map words, short lived the last */
+        assert(mbptr2off(p[0]) == (1U << 31) && mbptr2off(p[198]) == (1U << 31) + 24 * 8 + 6);
+        assert(mbptr2off(p[1]) == (1U << 31) + KBB * 1024 - 8);
+        for (i=1; i < 200; i += 2) {
+            mbfree(p[i]);
+        }
+        p[1] = mballoc_hint(512, MB_LIFETIME_SHORT);
+        assert(mbptr2off(p[1]) == (1U << 31) + KBB * 1024 - 8);
+        for (i=0; i < 200; i += 2) {
+            mbfree(p[i]);
+        }
+        p[0] = mballoc_hint(512, MB_LIFETIME_LONG);
+        assert(mbptr2off(p[0]) == (1U << 31));
+        mbfree(p[0]);
+        mbfree(p[1]);
+    }
+    assert(mbtestfree());
+
+    printf("\nTest 20 - Place blocks with first fit and best fit policies\n");
+    {
+        assert(mbpolicy_set(2048, MB_POLICY_FIRSTFIT));
+        for (i=0; i < 16; i++) {
+            p[i] = mballoc(256);
+            assert(mbptr2off(p[i]) == (1U << 31) + i);
+        }
+        mbfree_n(&p[1], 2);
+        mbfree_n(&p[9], 6);
+
+        /* best fit takes the tightest run, first fit the lowest */
+        assert(mbpolicy_set(2048, MB_POLICY_BESTFIT));
+        p[16] = mballoc(768);
+        assert(mbptr2off(p[16]) == (1U << 31) + 9);
+        p[17] = mballoc(512);
+        assert(mbptr2off(p[17]) == (1U << 31) + 1);
+        assert(mbpolicy_set(2048, MB_POLICY_FIRSTFIT));
+        p[18] = mballoc(256);
+        assert(mbptr2off(p[18]) == (1U << 31) + 12);
+
+        assert(!mbpolicy_set(2048, 3) && mberr() == MBERR_CONFIG);
+        assert(!mbpolicy_set(4096, MB_POLICY_NEXTFIT) && mberr() == MBERR_BIG);
+
+        /* instances are not created with settings the setters refuse */
+        {
+            mbconfig_t  badpolicy = { 1, 1, 0, MB_POLICY_FULLEST + 1, MB_POLICY_NEXTFIT };
+            mbconfig_t  badround = { 1, 1, 0, MB_POLICY_NEXTFIT, MB_POLICY_NEXTFIT, 0, 0, MB_ROUND_POW2 + 1 };
+            mbconfig_t  badreserve = { 1, 1, 0, MB_POLICY_NEXTFIT, MB_POLICY_NEXTFIT, 0, 0, 0, 0, 1025 };
+            mbconfig_t  badsmall = { 0, 1 };
+            mbconfig_t  badbig = { 1, MB_K_MAX + 1 };
+
+            assert(mbcreate_in(NULL, &badpolicy) == NULL && mberr() == MBERR_CONFIG);
+            assert(mbcreate_in(NULL, &badround) == NULL && mberr() == MBERR_CONFIG);
+            assert(mbcreate_in(NULL, &badreserve) == NULL && mberr() == MBERR_CONFIG);
+            assert(mbcreate_in(NULL, &badsmall) == NULL && mberr() == MBERR_CONFIG);
+            assert(mbcreate_in(NULL, &badbig) == NULL && mberr() == MBERR_CONFIG);
+        }
+        assert(mbpolicy_set(2048, MB_POLICY_NEXTFIT));
+        p[1] = p[2] = NULL;
+        for (i=9; i < 15; i++) {
+            p[i] = NULL;
+        }
+        mbfree_n(p, 19);
+    }
+    assert(mbtestfree());
+
+    printf("\nTest 21 - Search runs longer than the free run of the current map word from the next\n");
+    {
+        mbreset();
+        p[0] = mballoc(112);
+        p[1] = mballoc(128);
+        p[2] = mballoc(16);
+        p[3] = mballoc(16);
+        p[4] = mballoc(96);
+        assert(mbptr2off(p[0]) == 0 && mbptr2off(p[1]) == 8 && mbptr2off(p[2]) == 16);
+        assert(mbptr2off(p[3]) == 17 && mbptr2off(p[4]) == 18);
+
+        /* freeing in the current map word makes room for its runs again */
+        mbfree(p[3]);
+        p[3] = mballoc(16);
+        assert(mbptr2off(p[3]) == 17);
+        p[5] = mballoc(16);
+        assert(mbptr2off(p[5]) == 24);
+        mbfree_n(p, 6);
+    }
+    assert(mbtestfree());
+
+    printf("\nTest 22 - Segregate run lengths into slab map words\n");
+    {
+        mbconfig_t  config = { 1, 1, 0, MB_POLICY_SLAB, MB_POLICY_NEXTFIT };
+        mbctx_t     *child, *root;
+
+        assert(!mbpolicy_set(16, MB_POLICY_SLAB) && mberr() == MBERR_CONFIG);
+        child = mbcreate_in(NULL, &config);
+        assert(child);
+        root = mbuse(child);
+
+        /* 16 and 48 byte blocks never share a map word */
+        for (i=0; i < 40; i++) {
+            p[i] = mballoc(i % 2 ? 48 : 16);
+            fill(p[i], i % 2 ? 48 : 16);
+        }
+        for (i=0; i < 40; i += 2) {
+            for (j=1; j < 40; j += 2) {
+                assert(mbptr2off(p[i]) / 8 != mbptr2off(p[j]) / 8);
+            }
+        }
+        assert(mbptr2off(p[0]) == 0 && mbptr2off(p[1]) == 8 && mbptr2off(p[3]) == 11);
+
+        /* emptied map words are reused by any run length, last emptied first */
+        j = mbptr2off(p[38]);
+        for (i=0; i < 40; i += 2) {
+            verify(p[i], 16);
+            mbfree(p[i]);
+        }
+        p[0] = mballoc(128);
+        assert(mbptr2off(p[0]) == j / 8 * 8);
+        p[2] = mballoc(64);
+        p[4] = mballoc(64);
+        assert(mbptr2off(p[2]) / 8 == mbptr2off(p[4]) / 8);
+
+        /* reset empties all map words at once */
+        mbreset();
+        p[0] = mballoc(48);
+        assert(mbptr2off(p[0]) == 0);
+        mbfree(p[0]);
+        assert(mbtestfree());
+
+        assert(mbuse(root) == child);
+        mbdestroy(child);
+    }
+    assert(mbtestfree());
+
+    printf("\nTest 23 - Start runs at aligned nibbles of a map word\n");
+    {
+        mbconfig_t  config = { 1, 1, 0, MB_POLICY_NEXTFIT, MB_POLICY_NEXTFIT, 1 };
+        mbctx_t     *child, *root;
+
+        child = mbcreate_in(NULL, &config);
+        assert(child);
+        root = mbuse(child);
+
+        p[0] = mballoc(16);
+        p[1] = mballoc(32);
+        p[2] = mballoc(16);
+        p[3] = mballoc(48);
+        p[4] = mballoc(16);
+        assert(mbptr2off(p[0]) == 0 && mbptr2off(p[1]) == 2 && mbptr2off(p[2]) == 1);
+        assert(mbptr2off(p[3]) == 4 && mbptr2off(p[4]) == 7);
+
+        /* freed aligned runs coalesce into the next larger aligned run */
+        mbfree_n(p, 3);
+        p[0] = mballoc(64);
+        assert(mbptr2off(p[0]) == 0);
+        mbfree(p[0]);
+        mbfree(p[3]);
+        mbfree(p[4]);
+        assert(mbtestfree());
+
+        assert(mbuse(root) == child);
+        mbdestroy(child);
+    }
+    assert(mbtestfree());
+
+    printf("\nTest 24 - Round block sizes to even and power of 2 run lengths\n");
+    {
+        assert(mbround_set(16, MB_ROUND_EVEN));
+        assert(mbgoodsize(16) == 16 && mbgoodsize(48) == 64 && mbgoodsize(80) == 96);
+        p[0] = mballoc(48);
+        p[1] = mballoc_fast(112);
+        assert(mbsize(p[0]) == 64 && mbsize(p[1]) == 128);
+        assert(mbround_set(16, MB_ROUND_POW2));
+        assert(mbgoodsize(32) == 32 && mbgoodsize(48) == 64 && mbgoodsize(80) == 128);
+        assert(mbround_set(2048, MB_ROUND_POW2));
+        assert(mbgoodsize(768) == 1024 && mbgoodsize(1280) == 2048);
+        p[2] = mballoc(1280);
+        assert(mbsize(p[2]) == 2048);
+
+        assert(!mbround_set(16, 3) && mberr() == MBERR_CONFIG);
+        assert(mbround_set(16, MB_ROUND_NONE) && mbround_set(2048, MB_ROUND_NONE));
+        assert(mbgoodsize(48) == 48 && mbsize(p[0]) == 64);
+        mbfree_n(p, 3);
+    }
+    assert(mbtestfree());
+
+    printf("\nTest 25 - Fill the fullest map word the run fits in\n");
+    {
+        mbconfig_t  config = { 1, 1, 0, MB_POLICY_FULLEST, MB_POLICY_NEXTFIT };
+        mbctx_t     *child, *root;
+
+        child = mbcreate_in(NULL, &config);
+        assert(child);
+        root = mbuse(child);
+
+        for (i=0; i < 24; i++) {
+            p[i] = mballoc(16);
+            fill(p[i], 16);
+        }
+        assert(mbptr2off(p[23]) == 23);
+
+        /* map word 0 keeps 1 block, word 1 keeps 4 and word 2 keeps 7 */
+        for (i=1; i < 8; i++) {
+            verify(p[i], 16);
+            mbfree(p[i]);
+        }
+        for (i=12; i < 16; i++) {
+            mbfree(p[i]);
+        }
+        mbfree(p[23]);
+
+        p[23] = mballoc(16);
+        assert(mbptr2off(p[23]) == 23);
+        p[12] = mballoc(32);
+        assert(mbptr2off(p[12]) / 8 == 1);
+        p[1] = mballoc(64);
+        assert(mbptr2off(p[1]) == 1);
+
+        /* runs that fit in no partly used map word take an empty one */
+        p[2] = mballoc(128);
+        assert(mbptr2off(p[2]) == 24);
+
+        mbfree(p[0]);
+        mbfree(p[1]);
+        mbfree(p[2]);
+        for (i=8; i < 24; i++) {
+            if (i < 13 || i > 15) {
+                mbfree(p[i]);
+            }
+        }
+        assert(mbtestfree());
+
+        assert(mbuse(root) == child);
+        mbdestroy(child);
+    }
+    assert(mbtestfree());
+
+    printf("\nTest 26 - Borrow big block map words for a full small block space\n");
+    {
+        mbconfig_t  config = { 1, 1, 0, MB_POLICY_NEXTFIT, MB_POLICY_NEXTFIT, 0, 0, 0, 2 };
+        mbctx_t     *child, *root;
+        void        *q;
+
+        child = mbcreate_in(NULL, &config);
+        assert(child);
+        root = mbuse(child);
+
+        /* fill the small block space */
+        for (i=0; i < 128; i++) {
+            p[i] = mballoc(128);
+            assert(p[i]);
+        }
+
+        /* small blocks then come from the top big block map word, 16 bytes at a time */
+        for (i=128; i < 128 + 256; i++) {
+            p[i] = mballoc(16);
+            assert(p[i]);
+            fill(p[i], 16);
+            assert(mbsize(p[i]) == 16);
+            assert(mboff2ptr(mbptr2off(p[i])) == p[i]);
+        }
+        assert(mbptr2off(p[128]) == (1U << 31) + 127 * 8);
+        assert(mbptr2off(p[129]) >> 31 == 0);
+
+        /* two map words are borrowed, a third is not */
+        q = mballoc(16);
+        assert(q == NULL && mberr() == MBERR_NOMEM);
+        q = mballoc(2048);
+        assert(mbptr2off(q) == 1U << 31);
+        mbfree(q);
+
+        /* borrowed map words go back when they empty */
+        for (i=128; i < 128 + 256; i++) {
+            verify(p[i], 16);
+            mbfree(p[i]);
+        }
+        for (i=0; i < 128; i++) {
+            mbfree(p[i]);
+        }
+        assert(mbtestfree());
+
+        assert(mbuse(root) == child);
+        mbdestroy(child);
+    }
+    assert(mbtestfree());
+    {
+        mbconfig_t  config = { 1, 1, 1, MB_POLICY_NEXTFIT, MB_POLICY_NEXTFIT, 0, 0, 0, 2 };
+        mbctx_t     *child, *root;
+        void        *q;
+
+        child = mbcreate_in(NULL, &config);
+        assert(child);
+        root = mbuse(child);
+        for (i=0; i < 128; i++) {
+            p[i] = mballoc(128);
+        }
+
+        /* the last reference put gives the borrowed map word back */
+        q = mbref_alloc(16);
+        assert(q && mbptr2off(q) == (1U << 31) + 127 * 8);
+        mbref_get(q);
+        mbref_put(q);
+        assert(mbsize(q) == 16);
+        mbref_put(q);
+
+        /* so does aborting the only allocation in it */
+        q = mballoc(16);
+        assert(mbptr2off(q) == (1U << 31) + 127 * 8);
+        mbtx_begin();
+        p[128] = mballoc(16);
+        assert(mbptr2off(p[128]) >> 31 == 0);
+        mbfree(q);
+        mbtx_abort();
+
+        for (i=0; i < 128; i++) {
+            mbfree(p[i]);
+        }
+        assert(mbtestfree());
+
+        assert(mbuse(root) == child);
+        mbdestroy(child);
+    }
+    assert(mbtestfree());
+
+    printf("\nTest 27 - Recommend a configuration from a size histogram\n");
+    {
+        mbhist_t    hist[] = { {16, 1000}, {48, 300}, {2048, 20}, {300, 100}, {4096, 1} };
+        mbconfig_t  config;
+        mbctx_t     *child, *root;
+
+        assert(!mbautoconf(hist, 5, 0.001, &config) && mberr() == MBERR_BIG);
+        assert(!mbautoconf(hist, 4, 0, &config) && mberr() == MBERR_CONFIG);
+
+        /* 3 nibble runs pack tighter unrounded, 2 and 8 nibble runs are already powers of 2 */
+        assert(mbautoconf(hist, 4, 0.001, &config));
+        assert(config.k_sb_smallest == 3 && config.k_bb_smallest == 1);
+        assert(config.sb_round == MB_ROUND_NONE && config.bb_round == MB_ROUND_POW2);
+        assert(config.sb_policy == MB_POLICY_NEXTFIT && config.bb_policy == MB_POLICY_FULLEST);
+
+        /* the recommended instance holds the average live blocks */
+        child = mbcreate_in(NULL, &config);
+        assert(child);
+        root = mbuse(child);
+        for (i=0, j=0; i < 4; i++) {
+            for (cursize=0; cursize < hist[i].live; cursize++) {
+                p[j] = mballoc(hist[i].size);
+                assert(p[j++]);
+            }
+        }
+        while (j > 0) {
+            mbfree(p[--j]);
+        }
+        assert(mbtestfree());
+        assert(mbuse(root) == child);
+        mbdestroy(child);
+    }
+    assert(mbtestfree());
+
+    printf("\nTest 28 - Keep a reserve for priority allocations\n");
+    {
+        mbconfig_t  config = { 1, 1, 0, MB_POLICY_NEXTFIT, MB_POLICY_NEXTFIT, 0, 0, 0, 0, 16, 0 };
+        mbctx_t     *child, *root;
+        mbreserve_t stat;
+
+        child = mbcreate_in(NULL, &config);
+        assert(child);
+        root = mbuse(child);
+
+        /* plain allocations stop 16 small blocks short of a full space */
+        for (i=0; (p[i] = mballoc(128)) != NULL; i++)
+            ;
+        assert(i == 126 && mberr() == MBERR_NOMEM);
+        assert(mballoc_fast(16) == NULL && mballoc_near(16, p[0]) == NULL);
+        assert(mbreserve_stat(16, &stat));
+        assert(stat.reserve == 256 && stat.free == 256 && stat.used == 0 && stat.denied == 3);
+
+        /* priority allocations use the reserve */
+        p[i++] = mballoc_prio(128);
+        p[i++] = mballoc_prio(128);
+        assert(p[i - 2] && p[i - 1]);
+        assert(mballoc_prio(16) == NULL);
+        assert(mbreserve_stat(16, &stat));
+        assert(stat.free == 0 && stat.used == 256 && stat.peak == 256 && stat.prio == 2);
+        mbfree(p[--i]);
+        assert(mbreserve_stat(16, &stat) && stat.used == 128 && stat.peak == 256);
+
+        /* the big block space has no reserve */
+        assert(mbreserve_stat(2048, &stat) && stat.reserve == 0 && stat.free == 1024 * 256);
+
+        /* dropping the reserve frees it for plain allocations */
+        assert(mbreserve_set(16, 0));
+        assert(!mbreserve_set(16, 1025) && mberr() == MBERR_CONFIG);
+        p[i] = mballoc(128);
+        assert(p[i++]);
+        while (i > 0) {
+            mbfree(p[--i]);
+        }
+        assert(mbreserve_stat(16, &stat) && stat.free == 1024 * 16);
+        assert(mbtestfree());
+
+        assert(mbuse(root) == child);
+        mbdestroy(child);
+    }
+    assert(mbtestfree());
+    {
+        mbconfig_t  config = { 1, 1, 0, MB_POLICY_NEXTFIT, MB_POLICY_NEXTFIT, 0, 0, 0, 1, 16, 0 };
+        mbctx_t     *child, *root;
+        mbreserve_t stat;
+
+        child = mbcreate_in(NULL, &config);
+        assert(child);
+        root = mbuse(child);
+        for (i=0; i < 126; i++) {
+            p[i] = mballoc(128);
+        }
+        p[i] = mballoc_prio(128);
+        assert(p[i++]);
+
+        /* a plain allocation kept out of the reserve borrows, without counting as a priority one */
+        p[i] = mballoc(16);
+        assert(p[i] && mbptr2off(p[i++]) >> 31 == 1);
+        assert(mbreserve_stat(16, &stat) && stat.prio == 1 && stat.denied == 0 && stat.peak == 128);
+        while (i > 0) {
+            mbfree(p[--i]);
+        }
+        assert(mbtestfree());
+
+        assert(mbuse(root) == child);
+        mbdestroy(child);
+    }
+    assert(mbtestfree());
+
     mbterm();
-}
\ No newline at end of file
+}